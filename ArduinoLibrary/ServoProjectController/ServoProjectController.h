@@ -378,6 +378,8 @@ private:
     // ----------------------------------------
     // 0 : version <= 4.0
     // 1 : version >= 4.1 : breaking change is velocityUpscaling = 8 > 1
+    // 2 : version >= 4.2 : block read commands for consecutive registers
+    // 3 : version >= 4.2 : broadcast reference frames to node number 0
     unsigned char breakingChangeNr{0};
 };
 
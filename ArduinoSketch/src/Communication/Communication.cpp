@@ -49,11 +49,33 @@ void Communication::comIdleRun()
     }
 }
 
+void Communication::applyBroadcastReferences(bool valid)
+{
+    for (size_t i = 0; i != nodes.size(); ++i)
+    {
+        auto& node = nodes[i];
+        if (node->broadcastReferenceReceived && valid)
+        {
+            for (size_t j = 0; j != node->broadcastReference.size(); ++j)
+            {
+                node->intArray[j] = node->broadcastReference[j];
+                node->intArrayChanged[j] = true;
+            }
+        }
+        node->broadcastReferenceReceived = false;
+    }
+}
+
 void Communication::run()
 {
     bool receiveCompleate = false;
     serial.collectReadData();
-    if (serial.available() >= waitForBytes)
+
+    // Frames can arrive back to back, hold back the next one until the
+    // response to the current frame has been sent
+    bool waitForResponseToBeSent = communicationState == 0 && sendCommunicationState != 0;
+
+    if (!waitForResponseToBeSent && serial.available() >= waitForBytes)
     {
         lastAvailableReadTimestamp = millis();
         switch (communicationState)
@@ -67,11 +89,34 @@ void Communication::run()
                         communicationError = false;
                     }
 
-                    if (lastMessageNodeNr >= messageNodeNr)
+                    // Broadcast frames are sent first in a cycle
+                    if (messageNodeNr == broadcastNodeNr)
+                    {
+                        if (!cycleStartedByBroadcast)
+                        {
+                            onComCycleEvent();
+                            cycleStartedByBroadcast = true;
+                        }
+
+                        waitForBytes = 1;
+                        communicationState = 50;
+                        break;
+                    }
+
+                    repeatedFrame = messageNodeNr >= repeatedFrameNodeNrOffset;
+                    if (repeatedFrame)
                     {
-                        onComCycleEvent();
+                        messageNodeNr -= repeatedFrameNodeNrOffset;
+                    }
+                    else
+                    {
+                        if (lastMessageNodeNr >= messageNodeNr && !cycleStartedByBroadcast)
+                        {
+                            onComCycleEvent();
+                        }
+                        cycleStartedByBroadcast = false;
+                        lastMessageNodeNr = messageNodeNr;
                     }
-                    lastMessageNodeNr = messageNodeNr;
 
                     for (size_t i = 0; i != nodes.size(); ++i)
                     {
@@ -111,6 +156,10 @@ void Communication::run()
             case 2:
                 checksum = serial.read();
                 checksum += nodes[activeNodeIndex]->nodeNr;
+                if (repeatedFrame)
+                {
+                    checksum += repeatedFrameNodeNrOffset;
+                }
 
                 waitForBytes = 1;
                 communicationState = 4;
@@ -124,6 +173,13 @@ void Communication::run()
 
                 if (messageLength == 0)
                 {
+                    // A repeated frame without reads is answered with the checksum byte, like the
+                    // frame it repeats
+                    if (repeatedFrame && communicationState == 4)
+                    {
+                        sendCommunicationState = 1;
+                    }
+
                     waitForBytes = 1;
                     communicationState = 0;
                     break;
@@ -150,8 +206,31 @@ void Communication::run()
 
                     if ((command >> 7) == 1)
                     {
-                        sendCommandBuffer[numberOfSendCommands] = command - 128;
-                        numberOfSendCommands++;
+                        if (command - 128 == charBlockReadIndex || command - 128 == intBlockReadIndex)
+                        {
+                            if (messageLength == 0)
+                            {
+                                waitForBytes = 1;
+                                communicationError = true;
+                                communicationState = 0;
+                            }
+                            else
+                            {
+                                waitForBytes = 1;
+                                communicationState = 40;
+                            }
+                            break;
+                        }
+
+                        if (numberOfSendCommands < sendCommandBuffer.size())
+                        {
+                            sendCommandBuffer[numberOfSendCommands] = command - 128;
+                            numberOfSendCommands++;
+                        }
+                        else
+                        {
+                            communicationError = true;
+                        }
 
                         if (messageLength == 0)
                         {
@@ -258,6 +337,129 @@ void Communication::run()
                 }
                 break;
 
+            case 40:
+                {
+                    unsigned char parameter = serial.read();
+                    messageLength -= 1;
+
+                    checksum += parameter;
+
+                    if (numberOfSendCommands + 1 < sendCommandBuffer.size())
+                    {
+                        sendCommandBuffer[numberOfSendCommands] = command - 128;
+                        sendCommandBuffer[numberOfSendCommands + 1] = parameter;
+                        numberOfSendCommands += 2;
+                    }
+                    else
+                    {
+                        communicationError = true;
+                    }
+
+                    if (messageLength == 0)
+                    {
+                        waitForBytes = 1;
+                        receiveCompleate = true;
+                        communicationState = 0;
+                    }
+                    else
+                    {
+                        waitForBytes = 1;
+                        communicationState = 10;
+                    }
+                }
+                break;
+
+            case 50:
+                checksum = serial.read();
+                checksum += broadcastNodeNr;
+
+                waitForBytes = 1;
+                communicationState = 51;
+                break;
+
+            case 51:
+                messageLength = serial.read();
+
+                checksum += messageLength;
+
+                if (messageLength == 0)
+                {
+                    waitForBytes = 1;
+                    communicationState = 0;
+                }
+                else if ((messageLength - 1) % 6 != 0)
+                {
+                    waitForBytes = 1;
+                    communicationState = 100;
+                }
+                else
+                {
+                    waitForBytes = 1;
+                    communicationState = 52;
+                }
+                break;
+
+            case 52:
+                broadcastSlotNodeNr = serial.read();
+                messageLength -= 1;
+
+                checksum += broadcastSlotNodeNr;
+
+                if (messageLength == 0)
+                {
+                    applyBroadcastReferences(checksum == 0);
+
+                    waitForBytes = 1;
+                    communicationState = 0;
+                }
+                else
+                {
+                    waitForBytes = 6;
+                    communicationState = 53;
+                }
+                break;
+
+            case 53:
+                {
+                    std::array<int, 3> reference;
+                    for (size_t i = 0; i != reference.size(); ++i)
+                    {
+                        unsigned char byteValue = serial.read();
+                        signed short value = byteValue;
+                        checksum += byteValue;
+
+                        byteValue = serial.read();
+                        value += byteValue * static_cast<unsigned short>(256);
+                        checksum += byteValue;
+
+                        reference[i] = value;
+                    }
+                    messageLength -= 6;
+
+                    for (size_t i = 0; i != nodes.size(); ++i)
+                    {
+                        if (nodes[i]->nodeNr == broadcastSlotNodeNr)
+                        {
+                            nodes[i]->broadcastReference = reference;
+                            nodes[i]->broadcastReferenceReceived = true;
+                        }
+                    }
+                    broadcastSlotNodeNr++;
+
+                    if (messageLength == 0)
+                    {
+                        applyBroadcastReferences(checksum == 0);
+
+                        waitForBytes = 1;
+                        communicationState = 0;
+                    }
+                    else
+                    {
+                        waitForBytes = 6;
+                    }
+                }
+                break;
+
             case 100:
                 serial.read();
                 messageLength -= waitForBytes;
@@ -282,6 +484,8 @@ void Communication::run()
             waitForBytes = 1;
             communicationState = 0;
             lastMessageNodeNr = 0;
+            cycleStartedByBroadcast = false;
+            applyBroadcastReferences(false);
 
             onComIdleEvent();
         }
@@ -332,7 +536,18 @@ void Communication::run()
         case 10:
             {
                 unsigned char sendCommand = sendCommandBuffer[currentSendCommandIndex];
-                if ((sendCommand >> 6) == 1)
+                if (sendCommand == charBlockReadIndex || sendCommand == intBlockReadIndex)
+                {
+                    unsigned char parameter = sendCommandBuffer[currentSendCommandIndex + 1];
+                    serial.write(sendCommand);
+
+                    blockReadIndex = parameter >> 4;
+                    blockReadEndIndex = blockReadIndex + (parameter & 0x0f) + 1;
+                    currentSendCommandIndex += 2;
+                    sendCommunicationState = 20;
+                    break;
+                }
+                else if ((sendCommand >> 6) == 1)
                 {
                     int value = 0;
                     if (sendCommand >= 64 &&
@@ -357,11 +572,44 @@ void Communication::run()
                 currentSendCommandIndex++;
                 sendCommunicationState = 1;
             }
+            break;
+
+        case 20:
+            {
+                // One value per run to stay within the write buffer of the serial optimizer
+                unsigned char sendCommand = sendCommandBuffer[currentSendCommandIndex - 2];
+                if (sendCommand == intBlockReadIndex)
+                {
+                    int value = 0;
+                    if (blockReadIndex < nodes[activeNodeIndex]->intArray.size())
+                    {
+                        value = nodes[activeNodeIndex]->intArray[blockReadIndex];
+                    }
+                    serial.write(static_cast<unsigned char>(value));
+                    serial.write(static_cast<unsigned char>(value >> 8));
+                }
+                else
+                {
+                    char value = 0;
+                    if (blockReadIndex < nodes[activeNodeIndex]->charArray.size())
+                    {
+                        value = nodes[activeNodeIndex]->charArray[blockReadIndex];
+                    }
+                    serial.write(static_cast<unsigned char>(value));
+                }
+
+                blockReadIndex++;
+                if (blockReadIndex == blockReadEndIndex)
+                {
+                    sendCommunicationState = 1;
+                }
+            }
+            break;
     }
 
     serial.sendWrittenData();
 
-    if (receiveCompleate && checksum == 0)
+    if (receiveCompleate && checksum == 0 && !repeatedFrame)
     {
         nodes[activeNodeIndex]->intArray = intArrayBuffer;
         nodes[activeNodeIndex]->charArray = charArrayBuffer;
@@ -31,6 +31,10 @@ protected:
 
 private:
     unsigned char nodeNr;
+
+    std::array<int, 3> broadcastReference{{0}};
+    bool broadcastReferenceReceived{false};
+
     friend class Communication;
 };
 
@@ -50,6 +54,23 @@ private:
     void onComCycleEvent();
     void onComIdleEvent();
     void comIdleRun();
+    void applyBroadcastReferences(bool valid);
+
+    // Read commands with these indexes are followed by a parameter byte (start << 4) | (count - 1)
+    // and read count consecutive registers. The response is the index followed by the values.
+    static constexpr unsigned char charBlockReadIndex = 32;
+    static constexpr unsigned char intBlockReadIndex = 64 + 32;
+
+    // Frames to this node number carry int 0 to 2 (position, velocity and feed forward
+    // reference) for consecutive nodes: the first node number followed by six bytes per node.
+    // The values are applied as if written by the node's next frame, no response is sent.
+    static constexpr unsigned char broadcastNodeNr = 0;
+
+    // Frames to this offset plus the node number repeat a frame whose response was lost. They
+    // are answered like any frame, but they do not start a new com cycle and their writes
+    // are not applied, so the node number of a node must be below this offset. A repeated frame
+    // without commands is answered as well.
+    static constexpr unsigned char repeatedFrameNodeNrOffset = 128;
 
     SerialComOptimizer serial;
     std::array<int, 16> intArrayBuffer;
@@ -64,14 +85,19 @@ private:
     unsigned char command{0};
     unsigned char checksum{0};
     bool communicationError{false};
+    bool repeatedFrame{false};
     unsigned long lastAvailableReadTimestamp{millis()};
 
     int sendCommunicationState{0};
     unsigned char numberOfSendCommands{0};
     unsigned char currentSendCommandIndex{0};
     std::array<unsigned char, 100> sendCommandBuffer;
+    unsigned char blockReadIndex{0};
+    unsigned char blockReadEndIndex{0};
 
     unsigned char lastMessageNodeNr{0};
+    bool cycleStartedByBroadcast{false};
+    unsigned char broadcastSlotNodeNr{0};
 
     std::vector<std::unique_ptr<CommunicationNode> > nodes;
     size_t activeNodeIndex{0};
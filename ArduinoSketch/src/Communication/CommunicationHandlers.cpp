@@ -9,6 +9,7 @@ DCServoCommunicationHandler::DCServoCommunicationHandler(unsigned char nodeNr, s
     CommunicationNode::intArray[0] = this->dcServo->getPosition() * positionUpscaling;
     CommunicationNode::intArray[1] = 0;
     CommunicationNode::intArray[2] = 0;
+    CommunicationNode::charArray[15] = breakingChangeNr;
 
     intArrayIndex0Upscaler.set(CommunicationNode::intArray[0]);
 }
@@ -54,8 +55,18 @@ void DCServoCommunicationHandler::onReceiveCompleteEvent()
     if (CommunicationNode::intArrayChanged[0])
     {
         intArrayIndex0Upscaler.update(CommunicationNode::intArray[0]);
-        dcServo->loadNewReference(intArrayIndex0Upscaler.get() * (1.0f / positionUpscaling),
-                CommunicationNode::intArray[1] * (1.0f / velocityUpscaling), CommunicationNode::intArray[2]);
+        if (CommunicationNode::charArrayChanged[13])
+        {
+            CommunicationNode::charArrayChanged[13] = false;
+            dcServo->loadNewTimedReference(intArrayIndex0Upscaler.get() * (1.0f / positionUpscaling),
+                    CommunicationNode::intArray[1] * (1.0f / velocityUpscaling), CommunicationNode::intArray[2],
+                    CommunicationNode::charArray[13]);
+        }
+        else
+        {
+            dcServo->loadNewReference(intArrayIndex0Upscaler.get() * (1.0f / positionUpscaling),
+                    CommunicationNode::intArray[1] * (1.0f / velocityUpscaling), CommunicationNode::intArray[2]);
+        }
 
         CommunicationNode::intArrayChanged[0] = false;
         dcServo->openLoopMode(false);
@@ -127,12 +138,14 @@ void DCServoCommunicationHandler::onComIdleEvent()
 {
     CommunicationNode::intArrayChanged[0] = false;
     CommunicationNode::intArrayChanged[2] = false;
+    CommunicationNode::charArrayChanged[13] = false;
     dcServo->enable(false);
 
     statusLight.showDisabled();
     statusLight.showCommunicationInactive();
 }
 
+#if defined(_SAMD21_)
 DCServoCommunicationHandlerWithPwmInterface::
         DCServoCommunicationHandlerWithPwmInterface(unsigned char nodeNr, std::unique_ptr<DCServo> dcServo, unsigned char pwmPin,
             float scale, float offset) :
@@ -306,3 +319,5 @@ void DCServoCommunicationHandlerWithPwmInterface::config_gpio()
     gpio_in(0, 11);
     gpio_pmuxen(0, 11, PINMUX_PA11A_EIC_EXTINT11);
 }
+
+#endif
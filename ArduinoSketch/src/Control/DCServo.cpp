@@ -134,14 +134,50 @@ void DCServo::enableInternalFeedForward(bool enable)
 void DCServo::loadNewReference(float pos, float vel, int16_t feedForwardU)
 {
     ThreadInterruptBlocker blocker;
+    timedReferenceMode = false;
+    nrOfTimedReferences = 0;
     refInterpolator.loadNew(pos, vel, feedForwardU);
 }
 
+void DCServo::loadNewTimedReference(float pos, float vel, int16_t feedForwardU, uint8_t loopNr)
+{
+    ThreadInterruptBlocker blocker;
+    timedReferenceMode = true;
+
+    if (nrOfTimedReferences == timedReferences.size())
+    {
+        // Queue is full, make room by applying the oldest reference now
+        timedReferences[0].loopNr = static_cast<uint8_t>(this->loopNr);
+        applyDueTimedReferences();
+    }
+
+    timedReferences[nrOfTimedReferences] = TimedReference{pos, vel, feedForwardU, loopNr};
+    ++nrOfTimedReferences;
+}
+
+void DCServo::applyDueTimedReferences()
+{
+    // Loop numbers up to 128 loops back are late references that are applied directly
+    while (nrOfTimedReferences != 0 &&
+            static_cast<int8_t>(timedReferences[0].loopNr - static_cast<uint8_t>(loopNr)) <= 0)
+    {
+        const TimedReference& ref = timedReferences[0];
+        refInterpolator.updateTiming();
+        refInterpolator.loadNew(ref.pos, ref.vel, ref.feedForwardU);
+
+        --nrOfTimedReferences;
+        for (uint8_t i = 0; i != nrOfTimedReferences; ++i)
+        {
+            timedReferences[i] = timedReferences[i + 1];
+        }
+    }
+}
+
 void DCServo::triggerReferenceTiming()
 {
     ThreadInterruptBlocker blocker;
 
-    if (controlEnabled)
+    if (controlEnabled && !timedReferenceMode)
     {
         refInterpolator.updateTiming();
     }
@@ -232,6 +268,8 @@ void DCServo::controlLoop()
 
     if (controlEnabled)
     {
+        applyDueTimedReferences();
+
         if (pendingIntegralCalc)
         { 
             float limitedRefDiff = pwm - currentController->getLimitedRef();
@@ -322,7 +360,8 @@ void DCServo::controlLoop()
     else
     {
         refInterpolator.resetTiming();
-        loadNewReference(rawOutputPos, 0.0f, 0.0f);
+        refInterpolator.loadNew(rawOutputPos, 0.0f, 0.0f);
+        nrOfTimedReferences = 0;
         Ivel = 0.0f;
         outputPosOffset = rawOutputPos - rawMainPos;
         backlashControlGainDelayCounter = 0;
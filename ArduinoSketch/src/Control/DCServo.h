@@ -88,8 +88,14 @@ class DCServo
 
     void enableInternalFeedForward(bool enable = true);
 
+    // Leaves the timed reference mode and drops the queued timed references, the host
+    // only sends untimed references when it leaves the mode
     void loadNewReference(float pos, float vel, int16_t feedForwardU = 0);
 
+    // Queues a reference that the control loop applies when the lowest 8 bits of
+    // getLoopNr() reach loopNr, instead of timing it from when it was received
+    void loadNewTimedReference(float pos, float vel, int16_t feedForwardU, uint8_t loopNr);
+
     void triggerReferenceTiming();
 
     float getPosition();
@@ -121,6 +127,17 @@ class DCServo
 
     void identTestLoop();
 
+    void applyDueTimedReferences();
+
+    class TimedReference
+    {
+    public:
+        float pos;
+        float vel;
+        int16_t feedForwardU;
+        uint8_t loopNr;
+    };
+
     bool controlEnabled{false};
     bool onlyUseMainEncoderControl{false};
     bool openLoopControlMode{false};
@@ -171,6 +188,10 @@ class DCServo
 
     ReferenceInterpolator refInterpolator;
 
+    bool timedReferenceMode{false};
+    std::array<TimedReference, 4> timedReferences;
+    uint8_t nrOfTimedReferences{0};
+
     ComplementaryFilter outputEncoderFilter;
 
     float posDiff{0.0f};
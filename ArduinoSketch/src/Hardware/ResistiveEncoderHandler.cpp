@@ -13,7 +13,7 @@ ResistiveEncoderHandler::ResistiveEncoderHandler(int16_t pin, float unitsPerRev,
         sensor(pin, ADC_CTRLB_PRESCALER_DIV16_Val),
         scaling{unitsPerRev * (1.0f / 4096.0f) / superSampling}
 {
-    constexpr size_t s = static_cast<int>((vecSize - 1) / (compVec.size() - 1));
+    const size_t s = static_cast<int>((vecSize - 1) / (compVec.size() - 1));
     for (size_t i = 0; i != (compVec.size() - 1); ++i)
     {
         for (size_t j = 0; j != s; ++j)
@@ -434,6 +434,11 @@ uint32_t ThreadHandler::getTimingError()
 
 Thread* ThreadHandler::getNextThreadToRunAndRemoveFrom(Thread*& head)
 {
+    if (head == nullptr)
+    {
+        return nullptr;
+    }
+
     Thread* highestPriorityParrent = nullptr;
     Thread* highestPriority = nullptr;
 
@@ -337,6 +337,103 @@ uint32_t InterruptTimer::syncedMicrosImp()
     return micros();
 }
 
+#elif defined(__linux__)
+
+uint16_t InterruptTimer::interruptTick;
+uint32_t InterruptTimer::interruptTimerTime = 0;
+
+InterruptTimer* InterruptTimer::getInstance()
+{
+    static InterruptTimer inst(getInterruptTimerTick());
+    return &inst;
+}
+
+InterruptTimer::InterruptTimer(uint16_t period)
+{
+    if (period == 0)
+    {
+        period = 1000;
+    }
+    if (period < 10)
+    {
+        period = 10;
+    }
+    interruptTick = period;
+    interruptTimerTime = micros();
+}
+
+void InterruptTimer::enableNewInterrupt()
+{
+    enableNewInterruptImp();
+}
+
+void InterruptTimer::blockInterrupts()
+{
+    blockInterruptsImp();
+}
+
+void InterruptTimer::unblockInterrupts()
+{
+    unblockInterruptsImp();
+}
+
+uint32_t InterruptTimer::getInterruptTimestamp()
+{
+    return getInterruptTimestampImp();
+}
+
+uint32_t InterruptTimer::syncedMicros()
+{
+    return syncedMicrosImp();
+}
+
+void InterruptTimer::enableNewInterruptImp()
+{
+}
+
+void InterruptTimer::blockInterruptsImp()
+{
+}
+
+void InterruptTimer::unblockInterruptsImp()
+{
+}
+
+uint32_t InterruptTimer::getInterruptTimestampImp()
+{
+    return interruptTimerTime;
+}
+
+uint32_t InterruptTimer::syncedMicrosImp()
+{
+    return micros();
+}
+
+void InterruptTimer::enableTimerSyncEvents(bool enable)
+{
+}
+
+uint32_t InterruptTimer::runDueInterrupt()
+{
+    int32_t timeLeft = static_cast<int32_t>(interruptTimerTime + interruptTick - micros());
+    if (timeLeft > 0)
+    {
+        return timeLeft;
+    }
+
+    // Ticks missed while the host was busy are dropped, just like a pending
+    // interrupt flag on the target can only hold one overflow
+    interruptTimerTime += interruptTick;
+    while (static_cast<int32_t>(micros() - interruptTimerTime) >= interruptTick)
+    {
+        interruptTimerTime += interruptTick;
+    }
+
+    ThreadHandler::InterruptTimerInterface::interruptRun();
+
+    return 0;
+}
+
 #endif
 
 template<>
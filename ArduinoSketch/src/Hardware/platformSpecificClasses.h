@@ -97,4 +97,44 @@ private:
 
     friend void interruptHandler();
 };
+#elif defined(__linux__)
+// Host build used by the firmware emulator. There are no timer interrupts on the host,
+// the main loop calls runDueInterrupt() between its own work instead.
+class InterruptTimer : public ThreadHandler::InterruptTimerInterface
+{
+public:
+    static InterruptTimer* getInstance();
+
+    virtual ~InterruptTimer(){};
+
+    virtual void enableNewInterrupt() override;
+
+    virtual void blockInterrupts() override;
+    virtual void unblockInterrupts() override;
+
+    virtual uint32_t syncedMicros() override;
+
+    virtual uint32_t getInterruptTimestamp() override;
+
+    static  void enableNewInterruptImp();
+
+    static  void blockInterruptsImp();
+    static  void unblockInterruptsImp();
+
+    static  uint32_t syncedMicrosImp();
+ 
+    static  uint32_t getInterruptTimestampImp();
+
+    static void enableTimerSyncEvents(bool enable);
+
+    // Runs the interrupt if a tick is due, returns the time in micros until the next tick
+    static uint32_t runDueInterrupt();
+
+private:
+    InterruptTimer(uint16_t interruptTick);
+
+    static uint16_t interruptTick;
+
+    static uint32_t interruptTimerTime;
+};
 #endif
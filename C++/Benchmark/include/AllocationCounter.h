@@ -0,0 +1,9 @@
+#include <cstddef>
+
+#ifndef ALLOCATION_COUNTER_H
+#define ALLOCATION_COUNTER_H
+
+// Number of calls to the global operator new since program start
+size_t getAllocationCount();
+
+#endif
@@ -0,0 +1,75 @@
+#include "ServoProject.h"
+
+#include <array>
+#include <memory>
+#include <random>
+
+#ifndef DRIFTING_NODE_COMMUNICATION_H
+#define DRIFTING_NODE_COMMUNICATION_H
+
+// A bus with one node on a VirtualClock, whose control loop runs at a rate that differs from
+// the clock by drift. Each transaction samples the loop number shortly after it starts and
+// advances the clock by an exponentially distributed response latency, and every
+// lateResponseInterval:th response is late.
+class DriftingNodeCommunication : public Communication
+{
+public:
+    DriftingNodeCommunication(double loopCycleTime, double drift, double meanLatency,
+            size_t lateResponseInterval, double lateResponseDelay);
+
+    virtual void setNodeNr(unsigned char nr) override;
+
+    virtual void write(unsigned char nr, char value) override;
+
+    virtual void write(unsigned char nr, short int value) override;
+
+    virtual void requestReadChar(unsigned char nr) override;
+
+    virtual void requestReadInt(unsigned char nr) override;
+
+    virtual void requestReadCharBlock(unsigned char nr, unsigned char count) override;
+
+    virtual void requestReadIntBlock(unsigned char nr, unsigned char count) override;
+
+    virtual char getLastReadChar(unsigned char nr) override;
+
+    virtual short int getLastReadInt(unsigned char nr) override;
+
+    virtual void execute() override;
+
+    virtual void queueExecute() override;
+
+    virtual void executeQueue() override;
+
+    virtual double getLastTransactionTime(unsigned char nr) override;
+
+    virtual bool writeBroadcastReference(short int position, short int velocity, short int feedforward) override;
+
+    virtual void setTransactionDeadline(std::chrono::steady_clock::time_point deadline) override;
+
+    virtual CommunicationStatus getCommunicationStatus(unsigned char nr) override;
+
+    virtual std::shared_ptr<Clock> getClock() const override;
+
+    // Local time, in seconds since the clock epoch, at which the loop of the last sampled loop
+    // number started
+    double getLastSampledLoopTime() const;
+
+    // Advances the clock, as the time between the transactions
+    void advance(double time);
+
+private:
+    double getTime() const;
+
+    std::shared_ptr<VirtualClock> clock;
+    double nodeLoopCycleTime;
+    size_t lateResponseInterval;
+    double lateResponseDelay;
+    std::mt19937 randomGenerator{1};
+    std::exponential_distribution<double> latency;
+    size_t transactionCount{0};
+    long int lastSampledLoopNr{0};
+    std::array<char, 16> charArray{{0}};
+};
+
+#endif
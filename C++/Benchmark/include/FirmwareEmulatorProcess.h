@@ -0,0 +1,34 @@
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+#ifndef FIRMWARE_EMULATOR_PROCESS_H
+#define FIRMWARE_EMULATOR_PROCESS_H
+
+// Runs ../FirmwareEmulator/executable with the given arguments and reads the device name of
+// its pseudo terminal from the first output line
+class FirmwareEmulatorProcess
+{
+public:
+    FirmwareEmulatorProcess(const std::vector<std::string>& arguments);
+
+    ~FirmwareEmulatorProcess();
+
+    // False if the emulator is not compiled or could not be started
+    bool isRunning() const;
+
+    const std::string& getDeviceName() const;
+
+    // Stops the emulator and returns the lines it printed after the device name
+    std::vector<std::string> stop();
+
+private:
+    std::string readLine();
+
+    pid_t pid{-1};
+    int outputFd{-1};
+    std::string deviceName;
+    std::string output;
+};
+
+#endif
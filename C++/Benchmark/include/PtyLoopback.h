@@ -0,0 +1,71 @@
+#include <array>
+#include <vector>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <chrono>
+
+#ifndef PTY_LOOPBACK_H
+#define PTY_LOOPBACK_H
+
+class PtyLoopback
+{
+public:
+    // byteTime is the emulated transfer time per byte in seconds, 0 for no delay
+    PtyLoopback(const std::vector<unsigned char>& nodeNrs, double byteTime = 0.0,
+            unsigned char breakingChangeNr = 3);
+
+    ~PtyLoopback();
+
+    const std::string& getDeviceName() const;
+
+    // Bytes received and sent by the emulated nodes
+    size_t getTransferredBytes() const;
+
+    // Bytes received by the emulated nodes
+    size_t getReceivedBytes() const;
+
+    // Every interval:th response reports a checksum error, 0 to disable
+    void setResponseErrorInterval(size_t interval);
+
+    // Extra time in seconds before the node starts its responses
+    void setResponseDelay(unsigned char nodeNr, double delay);
+
+private:
+    class NodeRegisters
+    {
+    public:
+        bool active{false};
+        std::array<unsigned char, 16> charArray{0};
+        std::array<short int, 16> intArray{0};
+    };
+
+    void run();
+
+    size_t handleFrame(const unsigned char* frame, size_t size);
+
+    void writeResponse(size_t offset, size_t size);
+
+    int masterFd{-1};
+    int slaveFd{-1};
+    std::string deviceName;
+    double byteTime;
+    static constexpr double maxWriteInterval{0.0005};
+    std::chrono::steady_clock::time_point receiveStartTime;
+    std::chrono::steady_clock::time_point receiveDoneTime;
+    std::chrono::steady_clock::time_point sendDoneTime;
+
+    std::array<NodeRegisters, 256> nodes;
+    std::vector<unsigned char> receiveBuffer;
+    std::vector<unsigned char> sendBuffer;
+
+    std::atomic<size_t> transferredBytes{0};
+    std::atomic<size_t> receivedBytes{0};
+    std::atomic<size_t> responseErrorInterval{0};
+    std::array<std::atomic<double>, 128> responseDelays{};
+    size_t responseCount{0};
+    std::atomic<bool> shuttingDown{false};
+    std::thread t;
+};
+
+#endif
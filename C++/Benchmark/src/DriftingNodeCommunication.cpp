@@ -0,0 +1,115 @@
+#include "DriftingNodeCommunication.h"
+
+#include <cmath>
+
+DriftingNodeCommunication::DriftingNodeCommunication(double loopCycleTime, double drift, double meanLatency,
+        size_t lateResponseInterval, double lateResponseDelay) :
+    clock{std::make_shared<VirtualClock>()},
+    nodeLoopCycleTime{loopCycleTime * (1.0 + drift)},
+    lateResponseInterval{lateResponseInterval},
+    lateResponseDelay{lateResponseDelay},
+    latency{1.0 / meanLatency}
+{
+    charArray[15] = 5;
+}
+
+void DriftingNodeCommunication::setNodeNr(unsigned char nr)
+{
+}
+
+void DriftingNodeCommunication::write(unsigned char nr, char value)
+{
+}
+
+void DriftingNodeCommunication::write(unsigned char nr, short int value)
+{
+}
+
+void DriftingNodeCommunication::requestReadChar(unsigned char nr)
+{
+}
+
+void DriftingNodeCommunication::requestReadInt(unsigned char nr)
+{
+}
+
+void DriftingNodeCommunication::requestReadCharBlock(unsigned char nr, unsigned char count)
+{
+}
+
+void DriftingNodeCommunication::requestReadIntBlock(unsigned char nr, unsigned char count)
+{
+}
+
+char DriftingNodeCommunication::getLastReadChar(unsigned char nr)
+{
+    return charArray[nr];
+}
+
+short int DriftingNodeCommunication::getLastReadInt(unsigned char nr)
+{
+    return 0;
+}
+
+void DriftingNodeCommunication::execute()
+{
+    // The frame reaches the node 100 us after the transaction starts
+    advance(0.0001);
+    lastSampledLoopNr = static_cast<long int>(std::floor(getTime() / nodeLoopCycleTime));
+    charArray[11] = static_cast<char>(lastSampledLoopNr);
+
+    ++transactionCount;
+    advance(latency(randomGenerator) +
+            (transactionCount % lateResponseInterval == 0 ? lateResponseDelay : 0.0));
+}
+
+void DriftingNodeCommunication::queueExecute()
+{
+    execute();
+}
+
+void DriftingNodeCommunication::executeQueue()
+{
+}
+
+double DriftingNodeCommunication::getLastTransactionTime(unsigned char nr)
+{
+    return 0.0;
+}
+
+bool DriftingNodeCommunication::writeBroadcastReference(short int position, short int velocity, short int feedforward)
+{
+    return false;
+}
+
+void DriftingNodeCommunication::setTransactionDeadline(std::chrono::steady_clock::time_point deadline)
+{
+}
+
+CommunicationStatus DriftingNodeCommunication::getCommunicationStatus(unsigned char nr)
+{
+    CommunicationStatus status;
+    status.lastTransactionOk = true;
+    return status;
+}
+
+std::shared_ptr<Clock> DriftingNodeCommunication::getClock() const
+{
+    return clock;
+}
+
+double DriftingNodeCommunication::getLastSampledLoopTime() const
+{
+    return lastSampledLoopNr * nodeLoopCycleTime;
+}
+
+void DriftingNodeCommunication::advance(double time)
+{
+    clock->advance(std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(time)));
+}
+
+double DriftingNodeCommunication::getTime() const
+{
+    return std::chrono::duration<double>(clock->now().time_since_epoch()).count();
+}
@@ -0,0 +1,109 @@
+#include "FirmwareEmulatorProcess.h"
+
+#include <array>
+#include <csignal>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static const char* const emulatorPath = "../FirmwareEmulator/executable";
+
+FirmwareEmulatorProcess::FirmwareEmulatorProcess(const std::vector<std::string>& arguments)
+{
+    if (::access(emulatorPath, X_OK) != 0)
+    {
+        return;
+    }
+
+    std::array<int, 2> pipeFds;
+    if (::pipe(pipeFds.data()) != 0)
+    {
+        return;
+    }
+
+    std::vector<std::string> argStrings{emulatorPath};
+    argStrings.insert(argStrings.end(), arguments.begin(), arguments.end());
+    std::vector<char*> argv;
+    for (auto& a : argStrings)
+    {
+        argv.push_back(&a[0]);
+    }
+    argv.push_back(nullptr);
+
+    pid = ::fork();
+    if (pid == 0)
+    {
+        ::dup2(pipeFds[1], STDOUT_FILENO);
+        ::close(pipeFds[0]);
+        ::close(pipeFds[1]);
+        ::execv(emulatorPath, argv.data());
+        ::_exit(127);
+    }
+
+    ::close(pipeFds[1]);
+    outputFd = pipeFds[0];
+    if (pid < 0)
+    {
+        return;
+    }
+
+    deviceName = readLine();
+}
+
+FirmwareEmulatorProcess::~FirmwareEmulatorProcess()
+{
+    stop();
+}
+
+bool FirmwareEmulatorProcess::isRunning() const
+{
+    return pid > 0 && !deviceName.empty();
+}
+
+const std::string& FirmwareEmulatorProcess::getDeviceName() const
+{
+    return deviceName;
+}
+
+std::vector<std::string> FirmwareEmulatorProcess::stop()
+{
+    std::vector<std::string> lines;
+    if (pid > 0)
+    {
+        ::kill(pid, SIGTERM);
+        for (std::string line = readLine(); !line.empty(); line = readLine())
+        {
+            lines.push_back(line);
+        }
+        ::waitpid(pid, nullptr, 0);
+        pid = -1;
+    }
+
+    if (outputFd != -1)
+    {
+        ::close(outputFd);
+        outputFd = -1;
+    }
+
+    return lines;
+}
+
+std::string FirmwareEmulatorProcess::readLine()
+{
+    size_t end;
+    while ((end = output.find('\n')) == std::string::npos)
+    {
+        std::array<char, 256> buffer;
+        ssize_t size = ::read(outputFd, buffer.data(), buffer.size());
+        if (size <= 0)
+        {
+            std::string line;
+            line.swap(output);
+            return line;
+        }
+        output.append(buffer.data(), size);
+    }
+
+    std::string line = output.substr(0, end);
+    output.erase(0, end + 1);
+    return line;
+}
@@ -0,0 +1,283 @@
+#include "PtyLoopback.h"
+
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+#include <pty.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+PtyLoopback::PtyLoopback(const std::vector<unsigned char>& nodeNrs, double byteTime,
+        unsigned char breakingChangeNr) :
+    byteTime{byteTime}
+{
+    std::array<char, 256> name{0};
+    if (::openpty(&masterFd, &slaveFd, name.data(), nullptr, nullptr) != 0)
+    {
+        throw std::runtime_error("Could not open pseudo terminal");
+    }
+    deviceName = name.data();
+
+    termios settings;
+    ::tcgetattr(slaveFd, &settings);
+    ::cfmakeraw(&settings);
+    ::tcsetattr(slaveFd, TCSANOW, &settings);
+
+    for (auto nr : nodeNrs)
+    {
+        nodes[nr].active = true;
+        nodes[nr].charArray[15] = breakingChangeNr;
+    }
+
+    t = std::thread{&PtyLoopback::run, this};
+}
+
+PtyLoopback::~PtyLoopback()
+{
+    shuttingDown = true;
+    if (t.joinable())
+    {
+        t.join();
+    }
+
+    ::close(slaveFd);
+    ::close(masterFd);
+}
+
+const std::string& PtyLoopback::getDeviceName() const
+{
+    return deviceName;
+}
+
+size_t PtyLoopback::getTransferredBytes() const
+{
+    return transferredBytes;
+}
+
+size_t PtyLoopback::getReceivedBytes() const
+{
+    return receivedBytes;
+}
+
+void PtyLoopback::setResponseErrorInterval(size_t interval)
+{
+    responseErrorInterval = interval;
+}
+
+void PtyLoopback::setResponseDelay(unsigned char nodeNr, double delay)
+{
+    responseDelays[nodeNr % 128] = delay;
+}
+
+void PtyLoopback::run()
+{
+    std::array<unsigned char, 1024> readBuffer;
+
+    while (!shuttingDown)
+    {
+        pollfd pollFd{masterFd, POLLIN, 0};
+        if (::poll(&pollFd, 1, 100) <= 0)
+        {
+            continue;
+        }
+
+        ssize_t bytesRead = ::read(masterFd, readBuffer.data(), readBuffer.size());
+        if (bytesRead <= 0)
+        {
+            continue;
+        }
+
+        receiveBuffer.insert(receiveBuffer.end(), readBuffer.begin(), readBuffer.begin() + bytesRead);
+        receiveStartTime = std::chrono::steady_clock::now();
+
+        size_t handledBytes = 0;
+        while (true)
+        {
+            sendBuffer.clear();
+            size_t frameSize = handleFrame(receiveBuffer.data() + handledBytes,
+                    receiveBuffer.size() - handledBytes);
+            if (frameSize == 0)
+            {
+                break;
+            }
+            double responseDelay = sendBuffer.empty() ?
+                    0.0 : responseDelays[receiveBuffer[handledBytes] % 128].load();
+            handledBytes += frameSize;
+            transferredBytes += frameSize + sendBuffer.size();
+            receivedBytes += frameSize;
+
+            if (byteTime == 0.0)
+            {
+                std::this_thread::sleep_for(std::chrono::duration<double>(responseDelay));
+                writeResponse(0, sendBuffer.size());
+                continue;
+            }
+
+            // The bus is full duplex, each node answers as soon as its own frame has
+            // arrived, so a batch of frames streams its responses back. The bus times are
+            // accumulated to not add the sleep overshoot of every frame.
+            using namespace std::chrono;
+            auto toDuration = [this](size_t bytes)
+                {
+                    return duration_cast<steady_clock::duration>(duration<double>(bytes * byteTime));
+                };
+            receiveDoneTime = std::max(receiveDoneTime, receiveStartTime) + toDuration(frameSize);
+            sendDoneTime = std::max(sendDoneTime, receiveDoneTime) +
+                    duration_cast<steady_clock::duration>(duration<double>(responseDelay));
+
+            // Long responses are written in parts to not leave gaps on the line that look
+            // like an idle bus to the host
+            const size_t partSize = std::max(static_cast<size_t>(maxWriteInterval / byteTime), size_t{1});
+            size_t written = 0;
+            do
+            {
+                size_t part = std::min(partSize, sendBuffer.size() - written);
+                sendDoneTime += toDuration(part);
+                std::this_thread::sleep_until(sendDoneTime);
+                writeResponse(written, part);
+                written += part;
+            }
+            while (written != sendBuffer.size());
+        }
+        receiveBuffer.erase(receiveBuffer.begin(), receiveBuffer.begin() + handledBytes);
+    }
+}
+
+void PtyLoopback::writeResponse(size_t offset, size_t size)
+{
+    if (size != 0)
+    {
+        ssize_t bytesWritten = ::write(masterFd, sendBuffer.data() + offset, size);
+        (void)bytesWritten;
+    }
+}
+
+size_t PtyLoopback::handleFrame(const unsigned char* frame, size_t size)
+{
+    if (size < 3 || size < 3u + frame[2])
+    {
+        return 0;
+    }
+
+    const size_t frameSize = 3 + frame[2];
+
+    if (frame[0] == 0)
+    {
+        unsigned char checksum = 0;
+        for (size_t i = 0; i != frameSize; ++i)
+        {
+            checksum += frame[i];
+        }
+
+        if (checksum == 0 && frameSize >= 4 && (frameSize - 4) % 6 == 0)
+        {
+            for (size_t i = 4, nr = frame[3]; i != frameSize; i += 6, ++nr)
+            {
+                auto& node = nodes[nr % 256];
+                for (size_t j = 0; j != 3; ++j)
+                {
+                    node.intArray[j] = frame[i + 2 * j] + frame[i + 2 * j + 1] * 256;
+                }
+            }
+        }
+        return frameSize;
+    }
+
+    // Frames to 128 plus the node number repeat the reads of a frame without applying it
+    const bool repeated = frame[0] >= 128;
+    auto& node = nodes[frame[0] % 128];
+
+    if (!node.active)
+    {
+        return frameSize;
+    }
+
+    unsigned char checksum = 0;
+    for (size_t i = 0; i != frameSize; ++i)
+    {
+        checksum += frame[i];
+    }
+
+    if (!repeated)
+    {
+        using namespace std::chrono;
+        static const auto startTime = steady_clock::now();
+        node.charArray[11] = static_cast<unsigned char>(
+                duration_cast<microseconds>(steady_clock::now() - startTime).count() / 600);
+        node.intArray[3] = node.intArray[0];
+        node.intArray[10] = node.intArray[0];
+    }
+
+    for (size_t i = 3; i < frameSize;)
+    {
+        unsigned char command = frame[i];
+        if ((command == 128 + 32 || command == 128 + 96) && i + 1 < frameSize)
+        {
+            unsigned char index = command - 128;
+            unsigned char parameter = frame[i + 1];
+            sendBuffer.push_back(index);
+            for (size_t r = parameter >> 4; r != (parameter >> 4) + (parameter & 0x0f) + 1u; ++r)
+            {
+                if (index == 96)
+                {
+                    unsigned short value = r < 16 ? node.intArray[r] : 0;
+                    sendBuffer.push_back(static_cast<unsigned char>(value));
+                    sendBuffer.push_back(static_cast<unsigned char>(value >> 8));
+                }
+                else
+                {
+                    sendBuffer.push_back(r < 16 ? node.charArray[r] : 0);
+                }
+            }
+            i += 2;
+        }
+        else if (command >= 128)
+        {
+            unsigned char index = command - 128;
+            sendBuffer.push_back(index);
+            if (index >= 64)
+            {
+                unsigned short value = node.intArray[(index - 64) % 16];
+                sendBuffer.push_back(static_cast<unsigned char>(value));
+                sendBuffer.push_back(static_cast<unsigned char>(value >> 8));
+            }
+            else
+            {
+                sendBuffer.push_back(node.charArray[index % 16]);
+            }
+            i += 1;
+        }
+        else if (command >= 64 && i + 2 < frameSize)
+        {
+            if (!repeated)
+            {
+                node.intArray[(command - 64) % 16] = frame[i + 1] + frame[i + 2] * 256;
+            }
+            i += 3;
+        }
+        else if (command < 64 && i + 1 < frameSize)
+        {
+            if (!repeated)
+            {
+                node.charArray[command % 16] = frame[i + 1];
+            }
+            i += 2;
+        }
+        else
+        {
+            checksum = 1;
+            break;
+        }
+    }
+
+    ++responseCount;
+    if (responseErrorInterval != 0 && responseCount % responseErrorInterval == 0)
+    {
+        checksum = 1;
+    }
+
+    sendBuffer.push_back(checksum == 0 ? 0xff : 0);
+
+    return frameSize;
+}
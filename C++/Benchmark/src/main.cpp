@@ -0,0 +1,1445 @@
+#include "ServoProject.h"
+#include "PtyLoopback.h"
+#include "AllocationCounter.h"
+#include "FirmwareEmulatorProcess.h"
+#include "DriftingNodeCommunication.h"
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <cstdio>
+#include <time.h>
+
+double getThreadCpuTime()
+{
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+double getWallTime()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void printStatistics(const std::string& name, std::vector<double> samples)
+{
+    std::sort(samples.begin(), samples.end());
+
+    double sum = 0.0;
+    for (auto s : samples)
+    {
+        sum += s;
+    }
+
+    auto percentile = [&samples](double p)
+        {
+            size_t i = std::min(samples.size() - 1, static_cast<size_t>(p * samples.size()));
+            return samples[i] * 1e6;
+        };
+
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << std::setw(24) << std::left << name << std::right
+            << " mean: " << std::setw(7) << sum / samples.size() * 1e6 << " us"
+            << ", p50: " << std::setw(7) << percentile(0.5) << " us"
+            << ", p99: " << std::setw(7) << percentile(0.99) << " us"
+            << ", max: " << std::setw(7) << samples.back() * 1e6 << " us\n";
+}
+
+void printStatistics(const std::string& name, const LatencyStatistics& statistics)
+{
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << std::setw(24) << std::left << name << std::right
+            << " mean: " << std::setw(7) << statistics.mean * 1e6 << " us"
+            << ", p50: " << std::setw(7) << statistics.p50 * 1e6 << " us"
+            << ", p99: " << std::setw(7) << statistics.p99 * 1e6 << " us"
+            << ", p99.9: " << std::setw(7) << statistics.p999 * 1e6 << " us"
+            << ", max: " << std::setw(7) << statistics.max * 1e6 << " us\n";
+}
+
+void printByteCounts(const std::string& name, std::vector<double> bytesPerCycle)
+{
+    std::sort(bytesPerCycle.begin(), bytesPerCycle.end());
+    double sum = 0.0;
+    for (auto b : bytesPerCycle)
+    {
+        sum += b;
+    }
+
+    std::cout << std::setw(24) << std::left << name << std::right
+            << " mean: " << std::setw(7) << sum / bytesPerCycle.size() << " bytes"
+            << ", min: " << std::setw(4) << bytesPerCycle.front() << " bytes"
+            << ", max: " << std::setw(4) << bytesPerCycle.back() << " bytes\n";
+}
+
+// Creates a communicator for each node, polls the given values every cycle and runs the
+// communicators until all have completed their initialization
+std::vector<std::unique_ptr<DCServoCommunicator> > createInitializedServos(
+        const std::vector<unsigned char>& nodeNrs, Communication* com,
+        const std::vector<DCServoCommunicator::ReadValue>& polledValues = {})
+{
+    std::vector<std::unique_ptr<DCServoCommunicator> > servos;
+    for (auto n : nodeNrs)
+    {
+        servos.push_back(std::make_unique<DCServoCommunicator>(n, com));
+        for (auto v : polledValues)
+        {
+            servos.back()->setPollingDivisor(v, 1);
+        }
+    }
+
+    bool initComplete = false;
+    while (!initComplete)
+    {
+        initComplete = true;
+        for (auto& s : servos)
+        {
+            s->run();
+            initComplete = initComplete && s->isInitComplete();
+        }
+
+        // The loop time estimation during initialization needs the samples to be spread out in time
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    // The first cycle after the init sequence reads all registers once
+    for (auto& s : servos)
+    {
+        s->run();
+    }
+
+    return servos;
+}
+
+void benchmarkExecute(size_t iterations)
+{
+    PtyLoopback loopback({1});
+    SerialCommunication com(loopback.getDeviceName());
+
+    std::vector<double> latency;
+    std::vector<double> cpuTime;
+    latency.reserve(iterations);
+    cpuTime.reserve(iterations);
+
+    for (size_t i = 0; i != iterations + 100; ++i)
+    {
+        com.setNodeNr(1);
+        com.write(0, static_cast<short int>(i));
+        com.write(1, static_cast<short int>(0));
+        com.write(2, static_cast<short int>(0));
+        for (unsigned char r = 3; r != 10; ++r)
+        {
+            com.requestReadInt(r);
+        }
+        com.requestReadChar(11);
+
+        double wallStart = getWallTime();
+        double cpuStart = getThreadCpuTime();
+        com.execute();
+        double cpuEnd = getThreadCpuTime();
+        double wallEnd = getWallTime();
+
+        if (i >= 100)
+        {
+            latency.push_back(wallEnd - wallStart);
+            cpuTime.push_back(cpuEnd - cpuStart);
+        }
+    }
+
+    std::cout << "execute() with 3 int writes, 7 int reads and 1 char read over pty loopback, "
+            << iterations << " iterations\n";
+    printStatistics("execute() latency", latency);
+    printStatistics("execute() cpu time", cpuTime);
+}
+
+void benchmarkMultiBus(size_t cycles)
+{
+    // 115200 baud with one start and one stop bit
+    const double byteTime = 10.0 / 115200;
+    PtyLoopback loopback1({1, 2}, byteTime);
+    PtyLoopback loopback2({3, 4}, byteTime);
+    SerialCommunication com1(loopback1.getDeviceName());
+    SerialCommunication com2(loopback2.getDeviceName());
+
+    ServoManager manager(0.02, [&]()
+        {
+            std::vector<std::unique_ptr<DCServoCommunicator> > servos;
+            servos.push_back(std::make_unique<DCServoCommunicator>(1, &com1));
+            servos.push_back(std::make_unique<DCServoCommunicator>(3, &com2));
+            servos.push_back(std::make_unique<DCServoCommunicator>(2, &com1));
+            servos.push_back(std::make_unique<DCServoCommunicator>(4, &com2));
+            return servos;
+        });
+
+    std::vector<std::vector<double> > busCycleTimes(manager.getNumberOfBuses());
+    std::vector<double> sendToReadTime;
+    double sendTime = 0.0;
+    std::atomic<size_t> cycleCount{0};
+
+    manager.setHandlerFunctions([&](double dt, ServoManager& manager)
+        {
+            sendTime = getWallTime();
+        },
+        [&](double dt, ServoManager& manager)
+        {
+            if (cycleCount < cycles)
+            {
+                sendToReadTime.push_back(getWallTime() - sendTime);
+                for (size_t i = 0; i != manager.getNumberOfBuses(); ++i)
+                {
+                    busCycleTimes[i].push_back(manager.getBusCycleTime(i));
+                }
+            }
+            ++cycleCount;
+        });
+
+    while (cycleCount < cycles)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    manager.shutdown();
+
+    std::cout << "ServoManager cycle with 2 buses of 2 nodes each at 115200 baud, "
+            << cycles << " cycles\n";
+    for (size_t i = 0; i != busCycleTimes.size(); ++i)
+    {
+        printStatistics("bus " + std::to_string(i) + " cycle time", busCycleTimes[i]);
+    }
+    printStatistics("total cycle time", sendToReadTime);
+
+    auto snapshot = manager.getTimingSnapshot();
+    std::cout << "ServoManager timing snapshot\n";
+    printStatistics("wakeup lateness", snapshot.wakeupLateness);
+    printStatistics("send handler", snapshot.sendHandlerTime);
+    for (size_t i = 0; i != snapshot.nodeBusTime.size(); ++i)
+    {
+        printStatistics("servo " + std::to_string(i) + " bus time", snapshot.nodeBusTime[i]);
+        printStatistics("servo " + std::to_string(i) + " decode time", snapshot.nodeDecodeTime[i]);
+    }
+    printStatistics("read handler", snapshot.readHandlerTime);
+    printStatistics("cycle time", snapshot.cycleTime);
+}
+
+void benchmarkWakeupJitter(size_t cycles, bool realTime)
+{
+    PtyLoopback loopback({1}, 10.0 / 115200);
+    SerialCommunication com(loopback.getDeviceName());
+
+    ServoManager manager(0.004, [&]()
+        {
+            std::vector<std::unique_ptr<DCServoCommunicator> > servos;
+            servos.push_back(std::make_unique<DCServoCommunicator>(1, &com));
+            return servos;
+        }, false);
+
+    std::vector<double> jitter;
+    jitter.reserve(cycles);
+    std::atomic<size_t> cycleCount{0};
+
+    manager.setHandlerFunctions([&](double dt, ServoManager& manager)
+        {
+            if (cycleCount < cycles)
+            {
+                jitter.push_back(manager.getWakeupJitter());
+            }
+            ++cycleCount;
+        },
+        [](double dt, ServoManager& manager){});
+
+    RealTimeConfig config;
+    config.busySpinTime = 50e-6;
+    manager.enableRealTimeMode(realTime, config);
+
+    try
+    {
+        manager.start();
+    }
+    catch (std::runtime_error& e)
+    {
+        std::cout << "Real-time mode not available: " << e.what() << "\n";
+        return;
+    }
+
+    while (cycleCount < cycles)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    manager.shutdown();
+
+    printStatistics(realTime ? "wakeup jitter, real-time" : "wakeup jitter", jitter);
+}
+
+void benchmarkPollingRates(size_t cycles, bool subscribe, unsigned char breakingChangeNr = 2)
+{
+    PtyLoopback loopback({1}, 0.0, breakingChangeNr);
+    SerialCommunication com(loopback.getDeviceName());
+    DCServoCommunicator servo(1, &com);
+
+    using ReadValue = DCServoCommunicator::ReadValue;
+    if (subscribe)
+    {
+        servo.setPollingDivisor(ReadValue::position, 1);
+        servo.setPollingDivisor(ReadValue::velocity, 1);
+        servo.setPollingDivisor(ReadValue::current, 4);
+        servo.setPollingDivisor(ReadValue::controlSignal, 4);
+        servo.setPollingDivisor(ReadValue::time, 10);
+        servo.setPollingDivisor(ReadValue::loopTime, 100);
+        servo.setPollingDivisor(ReadValue::cpuLoad, 100);
+        servo.setPollingDivisor(ReadValue::opticalEncoderChannelData, 100);
+    }
+
+    while (!servo.isInitComplete())
+    {
+        servo.run();
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    // The first cycle after initialization still reads all registers
+    servo.run();
+
+    std::vector<double> bytesPerCycle;
+    for (size_t i = 0; i != cycles; ++i)
+    {
+        // Without subscriptions, every value is read each cycle through the getters
+        if (!subscribe)
+        {
+            servo.getPosition();
+            servo.getVelocity();
+            servo.getCurrent();
+            servo.getControlSignal();
+            servo.getTime();
+            servo.getLoopTime();
+            servo.getCpuLoad();
+            servo.getOpticalEncoderChannelData();
+        }
+
+        size_t bytesBefore = loopback.getTransferredBytes();
+        servo.setReference(0, 0, 0);
+        servo.run();
+        bytesPerCycle.push_back(loopback.getTransferredBytes() - bytesBefore);
+    }
+
+    std::string name = subscribe ? "polling divisors" : "getter reads";
+    if (breakingChangeNr < 2)
+    {
+        name += ", no block";
+    }
+
+    printByteCounts(name, bytesPerCycle);
+}
+
+void benchmarkBroadcastReference(size_t cycles, unsigned char breakingChangeNr)
+{
+    std::vector<unsigned char> nodeNrs{1, 2, 3, 4, 5, 6, 7};
+    PtyLoopback loopback(nodeNrs, 0.0, breakingChangeNr);
+    SerialCommunication com(loopback.getDeviceName());
+    com.enableBatchedTransactions();
+
+    auto servos = createInitializedServos(nodeNrs, &com, {DCServoCommunicator::ReadValue::position});
+
+    std::vector<double> sentBytes;
+    std::vector<double> receivedBytes;
+    for (size_t i = 0; i != cycles; ++i)
+    {
+        size_t sentBefore = loopback.getReceivedBytes();
+        size_t totalBefore = loopback.getTransferredBytes();
+        for (auto& s : servos)
+        {
+            s->setReference(i % 100, 0, 0);
+            s->queueRun();
+        }
+        com.executeQueue();
+        for (auto& s : servos)
+        {
+            s->completeRun();
+        }
+
+        size_t sent = loopback.getReceivedBytes() - sentBefore;
+        sentBytes.push_back(sent);
+        receivedBytes.push_back(loopback.getTransferredBytes() - totalBefore - sent);
+    }
+
+    std::string name = breakingChangeNr < 3 ? "per node" : "broadcast";
+    printByteCounts(name + ", sent", sentBytes);
+    printByteCounts(name + ", received", receivedBytes);
+}
+
+void benchmarkErrorRecovery(size_t cycles, bool recovery)
+{
+    std::vector<unsigned char> nodeNrs{1, 2, 3, 4, 5, 6, 7};
+    PtyLoopback loopback(nodeNrs, 10.0 / 115200, 5);
+    SerialCommunication com(loopback.getDeviceName());
+    com.enableBatchedTransactions();
+    com.enableErrorRecovery(recovery);
+
+    auto servos = createInitializedServos(nodeNrs, &com);
+
+    loopback.setResponseErrorInterval(50);
+
+    size_t failedCycles = 0;
+    size_t lostUpdates = 0;
+    std::vector<double> cycleTimes;
+    for (size_t i = 0; i != cycles; ++i)
+    {
+        auto startTime = std::chrono::steady_clock::now();
+        com.setTransactionDeadline(startTime + std::chrono::milliseconds(20));
+
+        try
+        {
+            for (auto& s : servos)
+            {
+                s->setReference(0, 0, 0);
+                s->queueRun();
+            }
+            com.executeQueue();
+            for (auto& s : servos)
+            {
+                s->completeRun();
+                lostUpdates += s->isCommunicationOk() ? 0 : 1;
+            }
+        }
+        catch (CommunicationError&)
+        {
+            ++failedCycles;
+            lostUpdates += servos.size();
+
+            // Let the remaining responses pass, a ServoManager would restart here
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        }
+
+        cycleTimes.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count());
+    }
+
+    size_t retries = 0;
+    for (auto& s : servos)
+    {
+        retries += s->getCommunicationStatus().retryCount;
+    }
+
+    std::string name = recovery ? "error recovery" : "no recovery";
+    std::cout << std::setw(24) << std::left << name << std::right
+            << " failed cycles: " << std::setw(4) << failedCycles
+            << ", lost node updates: " << std::setw(4) << lostUpdates
+            << ", retries: " << std::setw(4) << retries << "\n";
+    printStatistics(name + ", cycle", cycleTimes);
+}
+
+// Runs a servo on the firmware emulator, which drops the response to every 7th frame, and
+// checks that the firmware applied each frame the host sent exactly once. At least 30 cycles
+// are run, so that responses are also dropped after the init sequence and get repeated.
+bool checkRepeatedFrames(size_t cycles)
+{
+    cycles = std::max(cycles, size_t{30});
+
+    FirmwareEmulatorProcess emulator({"1", "7"});
+    if (!emulator.isRunning())
+    {
+        std::cout << "repeated frames on the firmware emulator skipped, the emulator is not compiled\n";
+        return true;
+    }
+
+    size_t sentFrames = 0;
+    size_t retries = 0;
+    size_t failedTransactions = 0;
+    try
+    {
+        SerialCommunication com(emulator.getDeviceName());
+        com.enableErrorRecovery(true, cycles);
+        DCServoCommunicator servo(1, &com);
+        servo.setPollingDivisor(DCServoCommunicator::ReadValue::position, 1);
+        servo.setPollingDivisor(DCServoCommunicator::ReadValue::velocity, 1);
+
+        for (size_t i = 0; i < cycles || !servo.isInitComplete(); ++i)
+        {
+            servo.setReference(0, 0, 0);
+            servo.run();
+            ++sentFrames;
+            failedTransactions += servo.isCommunicationOk() ? 0 : 1;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        retries = servo.getCommunicationStatus().retryCount;
+    }
+    catch (std::exception& e)
+    {
+        std::cout << "FAILED: repeated frames on the firmware emulator, " << e.what() << "\n";
+        return false;
+    }
+
+    size_t comCycles = 0;
+    size_t appliedFrames = 0;
+    size_t droppedResponses = 0;
+    auto lines = emulator.stop();
+    bool parsed = !lines.empty() && std::sscanf(lines.back().c_str(),
+            "com cycles: %zu, applied frames: %zu, dropped responses: %zu",
+            &comCycles, &appliedFrames, &droppedResponses) == 3;
+
+    std::cout << "repeated frames on the firmware emulator, sent frames: " << sentFrames
+            << ", applied frames: " << appliedFrames << ", com cycles: " << comCycles
+            << ", dropped responses: " << droppedResponses << ", retries: " << retries
+            << ", failed transactions: " << failedTransactions << "\n";
+
+    // The first frame does not end a com cycle
+    if (!parsed || appliedFrames != sentFrames || comCycles + 1 != sentFrames ||
+            droppedResponses == 0 || retries == 0)
+    {
+        std::cout << "FAILED: the firmware did not apply every frame exactly once\n";
+        return false;
+    }
+
+    return true;
+}
+
+// Runs a servo with timed references on the firmware emulator, where every 4th cycle is late,
+// and checks that every reference reached the firmware as a timed reference. At least 30
+// cycles are run, so that references are also sent after the init sequence.
+bool checkTimedReferences(size_t cycles)
+{
+    cycles = std::max(cycles, size_t{30});
+
+    FirmwareEmulatorProcess emulator({"1"});
+    if (!emulator.isRunning())
+    {
+        std::cout << "timed references on the firmware emulator skipped, the emulator is not compiled\n";
+        return true;
+    }
+
+    size_t sentReferences = 0;
+    try
+    {
+        SerialCommunication com(emulator.getDeviceName());
+        DCServoCommunicator servo(1, &com);
+        servo.enableTimedReferences();
+
+        for (size_t i = 0; i < cycles || !servo.isInitComplete(); ++i)
+        {
+            double now = std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+            servo.setReferenceApplyTime(i % 4 == 0 ? now - 0.005 : now + 0.004);
+            sentReferences += servo.isInitComplete() ? 1 : 0;
+            servo.setReference(0, 0, 0);
+            servo.run();
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+    catch (std::exception& e)
+    {
+        std::cout << "FAILED: timed references on the firmware emulator, " << e.what() << "\n";
+        return false;
+    }
+
+    size_t comCycles = 0;
+    size_t appliedFrames = 0;
+    size_t timedReferences = 0;
+    size_t untimedReferences = 0;
+    auto lines = emulator.stop();
+    bool parsed = !lines.empty() && std::sscanf(lines.back().c_str(),
+            "com cycles: %zu, applied frames: %zu, timed references: %zu, untimed references: %zu",
+            &comCycles, &appliedFrames, &timedReferences, &untimedReferences) == 4;
+
+    std::cout << "timed references on the firmware emulator with late cycles, sent references: " << sentReferences
+            << ", timed: " << timedReferences << ", untimed: " << untimedReferences << "\n";
+
+    if (!parsed || timedReferences != sentReferences || untimedReferences != 0)
+    {
+        std::cout << "FAILED: references left the timed reference mode\n";
+        return false;
+    }
+
+    return true;
+}
+
+void benchmarkSilentNode(size_t cycles, bool adaptive)
+{
+    std::vector<unsigned char> nodeNrs{1, 2, 3, 4, 5, 6, 7};
+    PtyLoopback loopback(nodeNrs, 10.0 / 115200);
+    SerialCommunication com(loopback.getDeviceName());
+    com.enableErrorRecovery(true, cycles + 1);
+    com.enableAdaptiveTimeouts(adaptive);
+
+    auto servos = createInitializedServos(nodeNrs, &com);
+
+    // Node 8 is on the bus but does not answer
+    servos.push_back(std::make_unique<DCServoCommunicator>(8, &com));
+
+    size_t lostUpdates = 0;
+    std::vector<double> cycleTimes;
+    std::vector<double> silentNodeTimes;
+    for (size_t i = 0; i != cycles; ++i)
+    {
+        auto startTime = std::chrono::steady_clock::now();
+        com.setTransactionDeadline(startTime + std::chrono::milliseconds(18));
+
+        for (size_t j = 0; j != nodeNrs.size(); ++j)
+        {
+            servos[j]->setReference(0, 0, 0);
+            servos[j]->run();
+            lostUpdates += servos[j]->isCommunicationOk() ? 0 : 1;
+        }
+
+        auto silentNodeStartTime = std::chrono::steady_clock::now();
+        servos.back()->run();
+
+        auto endTime = std::chrono::steady_clock::now();
+        silentNodeTimes.push_back(std::chrono::duration<double>(endTime - silentNodeStartTime).count());
+        cycleTimes.push_back(std::chrono::duration<double>(endTime - startTime).count());
+    }
+
+    std::string name = adaptive ? "adaptive timeouts" : "fixed timeout";
+    std::cout << std::setw(24) << std::left << name << std::right
+            << " timeout node 1: " << std::setw(5) << com.getResponseTimeout(1) * 1000 << " ms"
+            << ", node 8: " << std::setw(5) << com.getResponseTimeout(8) * 1000 << " ms"
+            << ", lost updates of answering nodes: " << lostUpdates << "\n";
+    printStatistics(name + ", cycle", cycleTimes);
+    printStatistics(name + ", node 8", silentNodeTimes);
+}
+
+// Node 4 becomes slower than its response time statistics, it may time out a few times but
+// has to recover before it fails maxConsecutiveFailures transactions in a row, and its timeout
+// has to grow so that it no longer needs retries
+bool checkSlowNodeRecovery(size_t cycles)
+{
+    std::vector<unsigned char> nodeNrs{1, 2, 3, 4, 5, 6, 7};
+    PtyLoopback loopback(nodeNrs, 10.0 / 115200, 5);
+    SerialCommunication com(loopback.getDeviceName());
+    com.enableErrorRecovery(true);
+    com.enableAdaptiveTimeouts(true);
+
+    auto servos = createInitializedServos(nodeNrs, &com);
+    auto& slowServo = servos[3];
+
+    size_t slowNodeFailures = 0;
+    size_t slowNodeFailuresInLastHalf = 0;
+    size_t retriesBeforeLastHalf = 0;
+    double usualTimeout = 0.0;
+    double responseDelay = 0.0;
+    try
+    {
+        for (size_t i = 0; i != 2 * cycles; ++i)
+        {
+            if (i == cycles)
+            {
+                // Late by less than the quiet time after a failure, so that the late responses are
+                // drained and not taken for the response to a following frame
+                usualTimeout = com.getResponseTimeout(4);
+                responseDelay = usualTimeout + 0.001;
+                loopback.setResponseDelay(4, responseDelay);
+            }
+
+            for (auto& s : servos)
+            {
+                s->setReference(0, 0, 0);
+                s->run();
+            }
+
+            if (i == cycles + cycles / 2)
+            {
+                retriesBeforeLastHalf = slowServo->getCommunicationStatus().retryCount;
+            }
+
+            if (i >= cycles && !slowServo->isCommunicationOk())
+            {
+                ++slowNodeFailures;
+                slowNodeFailuresInLastHalf += i >= cycles + cycles / 2 ? 1 : 0;
+            }
+        }
+    }
+    catch (CommunicationError& e)
+    {
+        std::cout << "FAILED: slow node did not recover, " << e.what() << "\n";
+        return false;
+    }
+
+    size_t retriesInLastHalf = slowServo->getCommunicationStatus().retryCount - retriesBeforeLastHalf;
+
+    std::cout << "node 4 slowed down by " << std::setw(5) << responseDelay * 1000 << " ms"
+            << ", timeout before: " << std::setw(5) << usualTimeout * 1000 << " ms"
+            << ", after: " << std::setw(5) << com.getResponseTimeout(4) * 1000 << " ms"
+            << ", failed transactions: " << slowNodeFailures
+            << ", retries: " << slowServo->getCommunicationStatus().retryCount << "\n";
+
+    if (slowNodeFailuresInLastHalf != 0 || retriesInLastHalf != 0 || com.getResponseTimeout(4) < responseDelay)
+    {
+        std::cout << "FAILED: slow node still times out\n";
+        return false;
+    }
+
+    return true;
+}
+
+class BusMatrixRow
+{
+public:
+    size_t nodes;
+    std::string registers;
+    unsigned int baudRate;
+    std::string strategy;
+};
+
+// Runs back to back bus cycles without a ServoManager, so the cycle time is
+// the shortest cycleTime the bus can sustain for the given configuration
+void benchmarkBusMatrixRow(const BusMatrixRow& row, size_t cycles)
+{
+    using ReadValue = DCServoCommunicator::ReadValue;
+
+    std::vector<ReadValue> readValues{ReadValue::position};
+    if (row.registers == "motion")
+    {
+        readValues = {ReadValue::position, ReadValue::velocity, ReadValue::controlSignal, ReadValue::current};
+    }
+    else if (row.registers == "all")
+    {
+        readValues.clear();
+        for (int i = 0; i != static_cast<int>(ReadValue::nrOfReadValues); ++i)
+        {
+            readValues.push_back(static_cast<ReadValue>(i));
+        }
+    }
+
+    std::vector<unsigned char> nodeNrs;
+    for (size_t i = 0; i != row.nodes; ++i)
+    {
+        nodeNrs.push_back(static_cast<unsigned char>(i + 1));
+    }
+
+    // One start and one stop bit per byte
+    PtyLoopback loopback(nodeNrs, 10.0 / row.baudRate, row.strategy == "broadcast" ? 3 : 2);
+    SerialCommunication com(loopback.getDeviceName());
+
+    // Initialization reads every register, which is done with batching disabled
+    // as many nodes at a low baud rate would exceed the response timeout
+    auto servos = createInitializedServos(nodeNrs, &com, readValues);
+
+    auto runCycle = [&]()
+        {
+            for (auto& s : servos)
+            {
+                s->setReference(0, 0, 0);
+                s->queueRun();
+            }
+            com.executeQueue();
+            for (auto& s : servos)
+            {
+                s->completeRun();
+            }
+        };
+
+    // The first cycle after initialization still reads all registers
+    runCycle();
+    com.enableBatchedTransactions(row.strategy != "per node");
+
+    std::vector<double> cycleTimes;
+    cycleTimes.reserve(cycles);
+    size_t bytesBefore = loopback.getTransferredBytes();
+    double startTime = getWallTime();
+    for (size_t i = 0; i != cycles; ++i)
+    {
+        double cycleStartTime = getWallTime();
+        runCycle();
+        cycleTimes.push_back(getWallTime() - cycleStartTime);
+    }
+    double totalTime = getWallTime() - startTime;
+    double bytesPerCycle = static_cast<double>(loopback.getTransferredBytes() - bytesBefore) / cycles;
+
+    std::sort(cycleTimes.begin(), cycleTimes.end());
+    auto percentile = [&cycleTimes](double p)
+        {
+            return cycleTimes[std::min(cycleTimes.size() - 1, static_cast<size_t>(p * cycleTimes.size()))];
+        };
+
+    std::cout << std::fixed << std::setprecision(1)
+            << row.nodes << ","
+            << row.registers << ","
+            << row.baudRate << ","
+            << row.strategy << ","
+            << cycles / totalTime << ","
+            << percentile(0.5) * 1e6 << ","
+            << percentile(0.99) * 1e6 << ","
+            << cycleTimes.back() * 1e6 << ","
+            << bytesPerCycle << std::endl;
+}
+
+// Prints one csv row per configuration, the first line is the header
+void benchmarkBusMatrix(size_t cycles)
+{
+    std::cout << "nodes,registers,baud_rate,strategy,cycles_per_second,"
+            "p50_cycle_us,p99_cycle_us,max_cycle_us,bytes_per_cycle\n";
+
+    for (size_t nodes : {1, 2, 4, 8, 16})
+    {
+        for (const char* registers : {"position", "motion", "all"})
+        {
+            for (unsigned int baudRate : {115200, 1000000, 3000000})
+            {
+                for (const char* strategy : {"per node", "batched", "broadcast"})
+                {
+                    benchmarkBusMatrixRow({nodes, registers, baudRate, strategy}, cycles);
+                }
+            }
+        }
+    }
+}
+
+bool checkSteadyStateAllocations(size_t iterations, bool batched)
+{
+    std::vector<unsigned char> nodeNrs{1, 2, 3, 4, 5, 6, 7};
+    PtyLoopback loopback(nodeNrs);
+    SerialCommunication com(loopback.getDeviceName());
+    com.enableBatchedTransactions(batched);
+
+    auto servos = createInitializedServos(nodeNrs, &com);
+
+    auto runCycle = [&]()
+        {
+            for (auto& s : servos)
+            {
+                s->setReference(0, 0, 0);
+                s->queueRun();
+            }
+            com.executeQueue();
+            for (auto& s : servos)
+            {
+                s->completeRun();
+                s->getPosition();
+                s->getVelocity();
+                s->getControlError();
+                s->getCurrent();
+            }
+        };
+
+    for (size_t i = 0; i != 10; ++i)
+    {
+        runCycle();
+    }
+
+    size_t allocationsBefore = getAllocationCount();
+    for (size_t i = 0; i != iterations; ++i)
+    {
+        runCycle();
+    }
+    size_t allocations = getAllocationCount() - allocationsBefore;
+
+    std::cout << "Steady state cycle with " << nodeNrs.size() << " nodes" << (batched ? ", batched" : "")
+            << ": " << allocations << " allocations in " << iterations << " cycles\n";
+
+    return allocations == 0;
+}
+
+bool checkManagerCycleAllocations(size_t cycles)
+{
+    PtyLoopback loopback({1, 2}, 10.0 / 115200);
+    SerialCommunication com(loopback.getDeviceName());
+    com.enableBatchedTransactions();
+
+    ServoManager manager(0.004, [&]()
+        {
+            std::vector<std::unique_ptr<DCServoCommunicator> > servos;
+            servos.push_back(std::make_unique<DCServoCommunicator>(1, &com));
+            servos.push_back(std::make_unique<DCServoCommunicator>(2, &com));
+            return servos;
+        }, false);
+
+    const size_t warmupCycles = 10;
+    std::atomic<size_t> cycleCount{0};
+    std::atomic<size_t> allocationsBefore{0};
+    std::atomic<size_t> allocations{0};
+
+    // Captures too large for the small object buffer of std::function
+    std::array<double, 2> position{0};
+    std::array<double, 8> unusedCapture{0};
+    manager.setHandlerFunctions([&, unusedCapture](double dt, ServoManager& manager)
+        {
+            for (auto& s : manager.servos)
+            {
+                s->setReference(0, 0, unusedCapture[0]);
+            }
+        },
+        [&, unusedCapture](double dt, ServoManager& manager)
+        {
+            manager.getPosition(position);
+
+            size_t cycle = ++cycleCount;
+            if (cycle == warmupCycles)
+            {
+                allocationsBefore = getAllocationCount();
+            }
+            else if (cycle == warmupCycles + cycles)
+            {
+                allocations = getAllocationCount() - allocationsBefore;
+            }
+        });
+    manager.start();
+
+    ServoStateSnapshot snapshot;
+    manager.getServoStates(snapshot);
+    uint64_t lastCycleNr = 0;
+    bool snapshotsInOrder = true;
+    while (cycleCount < warmupCycles + cycles)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+        manager.getServoStates(snapshot);
+        snapshotsInOrder = snapshotsInOrder && snapshot.cycleNr >= lastCycleNr;
+        lastCycleNr = snapshot.cycleNr;
+    }
+    manager.shutdown();
+
+    std::cout << "ServoManager cycle with 2 nodes: " << allocations
+            << " allocations in " << cycles << " cycles\n";
+    if (!snapshotsInOrder)
+    {
+        std::cout << "FAILED: servo state snapshots out of order\n";
+    }
+
+    return allocations == 0 && snapshotsInOrder;
+}
+
+// Several threads read the servo states while the manager runs back to back cycles on a
+// virtual clock. All servos get the cycle number as reference, so a read that mixes two
+// cycles shows up as differing references. There are more reader threads than reader slots,
+// so some reads also wait for a free slot.
+bool checkConcurrentStateReaders(size_t cycles)
+{
+    const size_t nrOfServos = 6;
+    const double cycleTime = 0.01;
+
+    auto clock = std::make_shared<VirtualClock>();
+    SimulateCommunication com(clock);
+    ServoManager manager(cycleTime, [&]()
+        {
+            std::vector<std::unique_ptr<DCServoCommunicator> > servos;
+            for (size_t i = 0; i != nrOfServos; ++i)
+            {
+                servos.push_back(std::make_unique<DCServoCommunicator>(i + 1, &com));
+            }
+            return servos;
+        }, false);
+
+    std::atomic<size_t> cycleCount{0};
+    manager.setHandlerFunctions([&](double dt, ServoManager& manager)
+        {
+            double cycleNr = std::round(manager.getTime() / cycleTime);
+            for (auto& s : manager.servos)
+            {
+                s->setReference(cycleNr, 0.0, 0.0);
+            }
+        },
+        [&](double dt, ServoManager& manager)
+        {
+            ++cycleCount;
+        });
+    manager.start();
+
+    std::atomic<size_t> reads{0};
+    std::atomic<size_t> mixedReads{0};
+    std::vector<std::thread> readers;
+    const size_t nrOfReaders = ServoManager::maxConcurrentStateReaders + 2;
+    for (size_t i = 0; i != nrOfReaders; ++i)
+    {
+        readers.emplace_back([&]()
+            {
+                ServoStateSnapshot snapshot;
+                while (cycleCount < cycles)
+                {
+                    manager.getServoStates(snapshot);
+                    double expected = snapshot.cycleNr == 0 ? 0.0 : snapshot.cycleNr - 1.0;
+                    bool mixed = false;
+                    for (const auto& state : snapshot.servos)
+                    {
+                        mixed = mixed || state.referencePosition != expected;
+                    }
+                    mixedReads += mixed ? 1 : 0;
+                    ++reads;
+                }
+            });
+    }
+    for (auto& r : readers)
+    {
+        r.join();
+    }
+    manager.shutdown();
+
+    std::cout << "Servo state reads from " << nrOfReaders << " threads during " << cycles << " cycles: "
+            << reads << " reads, " << mixedReads << " mixing two cycles\n";
+    if (mixedReads != 0)
+    {
+        std::cout << "FAILED: servo state reads mixing two cycles\n";
+    }
+    return mixedReads == 0;
+}
+
+// Runs a simulated servo on a virtual clock with 10 ms cycles. A trajectory queued before the
+// start, with a reference every 3rd cycle from cycle 10 to 31, runs dry. In cycle 40 a second
+// trajectory from cycle 35 to 44 is queued, whose first two references are late. Checks the
+// reference set in every cycle and the underrun and late reference counts.
+bool checkReferenceQueueTrajectory()
+{
+    const double cycleTime = 0.01;
+    const size_t cycles = 50;
+    auto reference = [&](size_t cycleNr)
+        {
+            return TimedReference{cycleNr * cycleTime, 0.1 * cycleNr, 10.0, 0.0};
+        };
+
+    std::vector<ServoState> states(cycles);
+    size_t underruns = 0;
+    size_t lateReferences = 0;
+    {
+        auto clock = std::make_shared<VirtualClock>();
+        SimulateCommunication com(clock);
+        ServoManager manager(cycleTime, [&]()
+            {
+                std::vector<std::unique_ptr<DCServoCommunicator> > servos;
+                servos.push_back(std::make_unique<DCServoCommunicator>(1, &com));
+                return servos;
+            }, false);
+
+        ReferenceQueue& queue = manager.getReferenceQueue(0);
+        for (size_t i = 10; i <= 31; i += 3)
+        {
+            queue.push(reference(i));
+        }
+
+        std::atomic<size_t> cycleCount{0};
+        manager.setHandlerFunctions([&](double dt, ServoManager& manager)
+            {
+                if (cycleCount == 40)
+                {
+                    for (size_t i = 35; i <= 44; i += 3)
+                    {
+                        queue.push(reference(i));
+                    }
+                }
+            },
+            [&](double dt, ServoManager& manager)
+            {
+                manager.servos[0]->getState(states[cycleCount]);
+                if (++cycleCount == cycles)
+                {
+                    underruns = queue.getUnderrunCount();
+                    lateReferences = queue.getLateReferenceCount();
+                    manager.shutdown();
+                }
+            });
+        manager.start();
+
+        while (cycleCount < cycles)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        manager.shutdown();
+    }
+
+    // Interpolated references in the trajectories, the last reference held with zero velocity
+    // in the cycle after each trajectory and no references set otherwise
+    size_t wrongCycles = 0;
+    for (size_t i = 0; i != cycles; ++i)
+    {
+        bool inTrajectory = (i >= 10 && i <= 31) || (i >= 41 && i <= 44);
+        bool underrun = i == 32 || i == 45;
+        double position = inTrajectory ? 0.1 * i : underrun ? 0.1 * (i - 1) : states[i].referencePosition;
+        double velocity = inTrajectory ? 10.0 : underrun ? 0.0 : states[i].referenceVelocity;
+        if (states[i].referenceSent != (inTrajectory || underrun) ||
+                std::abs(states[i].referencePosition - position) > 1e-4 ||
+                std::abs(states[i].referenceVelocity - velocity) > 1e-4)
+        {
+            ++wrongCycles;
+        }
+    }
+
+    std::cout << "Reference queue trajectory of " << cycles << " cycles, wrong cycles: " << wrongCycles
+            << ", underruns: " << underruns << ", late references: " << lateReferences << "\n";
+
+    if (wrongCycles != 0 || underruns != 2 || lateReferences != 2)
+    {
+        std::cout << "FAILED: the reference queue did not set the expected references\n";
+        return false;
+    }
+
+    return true;
+}
+
+// Tracks a node whose control loop is 100 ppm slow, with 0.3 ms mean response latency and a
+// 5 ms late response every 97th transaction, on a virtual clock with one transaction every
+// 10 ms. Checks the drift estimates and the scatter of the loop timestamps in the second half.
+bool checkClockDriftTracking(size_t cycles)
+{
+    const double drift = 100e-6;
+    DriftingNodeCommunication bus(0.0006, drift, 0.0003, 97, 0.005);
+    DCServoCommunicator servo(1, &bus);
+
+    double unsynchronizedError = servo.getTimeSyncError();
+    while (!servo.isInitComplete())
+    {
+        servo.run();
+        bus.advance(0.001);
+    }
+    double initializedError = servo.getTimeSyncError();
+
+    std::vector<double> timestampErrors;
+    std::vector<double> driftErrors;
+    for (size_t i = 0; i != cycles; ++i)
+    {
+        bus.advance(0.01);
+        servo.run();
+        double timestamp = servo.getLocalTimeOfRemoteTime(servo.getTime());
+        if (i >= cycles / 2)
+        {
+            timestampErrors.push_back(timestamp - bus.getLastSampledLoopTime());
+            driftErrors.push_back(servo.getClockDrift() - drift);
+        }
+    }
+
+    // The timestamps are offset by the mean latency, only their scatter is checked
+    double mean = 0.0;
+    for (auto e : timestampErrors)
+    {
+        mean += e;
+    }
+    mean /= timestampErrors.size();
+    double scatter = 0.0;
+    for (auto e : timestampErrors)
+    {
+        scatter += (e - mean) * (e - mean);
+    }
+    scatter = std::sqrt(scatter / timestampErrors.size());
+    double driftError = 0.0;
+    double maxDriftError = 0.0;
+    for (auto e : driftErrors)
+    {
+        driftError += e;
+        maxDriftError = std::max(maxDriftError, std::abs(e));
+    }
+    driftError /= driftErrors.size();
+
+    std::cout << "clock drift of 100 ppm over " << cycles * 0.01 / 60 << " min, mean drift estimate: "
+            << std::setprecision(2) << (drift + driftError) * 1e6 << " ppm, max error: " << maxDriftError * 1e6
+            << " ppm, timestamp scatter: " << scatter * 1e6 << " us, sync error: "
+            << servo.getTimeSyncError() * 1e6 << " us\n" << std::setprecision(1);
+
+    if (!std::isinf(unsynchronizedError) || !std::isinf(initializedError) ||
+            !std::isfinite(servo.getTimeSyncError()))
+    {
+        std::cout << "FAILED: the sync error is not infinite until the clocks are synchronized\n";
+        return false;
+    }
+
+    if (std::abs(driftError) > 0.3e-6 || maxDriftError > 1e-6 || scatter > 15e-6)
+    {
+        std::cout << "FAILED: the clock drift is not tracked\n";
+        return false;
+    }
+
+    return true;
+}
+
+bool benchmarkTelemetryReplay(size_t cycles)
+{
+    const std::string fileName = "/tmp/ServoProjectBenchmarkTelemetry.bin";
+    const size_t nrOfServos = 6;
+
+    auto createServos = [](Communication* bus)
+        {
+            std::vector<std::unique_ptr<DCServoCommunicator> > servos;
+            for (size_t i = 0; i != nrOfServos; ++i)
+            {
+                servos.push_back(std::make_unique<DCServoCommunicator>(i + 1, bus));
+                servos.back()->setOffsetAndScaling(360.0 / 4096.0, 0.0, 0.0);
+            }
+            return servos;
+        };
+
+    double recordTime = getWallTime();
+    {
+        auto clock = std::make_shared<VirtualClock>();
+        SimulateCommunication com(clock);
+        ServoManager manager(0.01, [&](){ return createServos(&com); }, false);
+        manager.setTelemetryRecorder(std::make_shared<TelemetryRecorder>(fileName, cycles * nrOfServos));
+
+        std::atomic<size_t> cycleCount{0};
+        manager.setHandlerFunctions([&](double dt, ServoManager& manager)
+            {
+                double t = manager.getTime();
+                for (size_t i = 0; i != manager.servos.size(); ++i)
+                {
+                    manager.servos[i]->setReference(20.0 * std::sin(t + i), 20.0 * std::cos(t + i), 0.0);
+                }
+            },
+            [&](double dt, ServoManager& manager)
+            {
+                if (++cycleCount == cycles)
+                {
+                    manager.shutdown();
+                }
+            });
+        manager.start();
+
+        while (cycleCount < cycles)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        manager.shutdown();
+    }
+    recordTime = getWallTime() - recordTime;
+
+    TelemetryReader recording(fileName);
+    TelemetryReplay replay(recording, createServos);
+    auto report = replay.run();
+    std::remove(fileName.c_str());
+
+    std::cout << "Telemetry replay of " << nrOfServos << " simulated servos, " << report.replayedCycles
+            << " cycles of " << recording.getCycleTime() * 1000 << " ms\n";
+    std::cout << std::fixed << std::setprecision(1)
+            << "recording " << std::setw(8) << recordTime * 1000 << " ms, replay "
+            << std::setw(8) << report.replayTime * 1000 << " ms, "
+            << std::setw(10) << report.replayedCycles / report.replayTime << " cycles per second\n";
+
+    bool identical = report.replayedCycles == cycles;
+    for (size_t i = 0; i != report.servos.size(); ++i)
+    {
+        const auto& diff = report.servos[i];
+        std::cout << std::setprecision(6) << "servo " << i << ": " << diff.comparedCycles
+                << " cycles compared, max position diff " << diff.maxPositionDiff
+                << ", rms position diff " << diff.rmsPositionDiff << "\n";
+        identical = identical && diff.comparedCycles == cycles && diff.maxPositionDiff == 0.0 &&
+                diff.maxVelocityDiff == 0.0 && diff.maxControlErrorDiff == 0.0;
+    }
+    std::cout << std::defaultfloat;
+
+    if (!identical)
+    {
+        std::cout << "FAILED: replay of a simulated session differs from the recording\n";
+    }
+    return identical;
+}
+
+bool benchmarkDiscovery(bool batched)
+{
+    const std::vector<unsigned char> nodeNrs{1, 2, 3, 5, 7, 40, 63};
+    PtyLoopback loopback(nodeNrs, 10.0 / 115200);
+    SerialCommunication com(loopback.getDeviceName());
+    com.enableBatchedTransactions(batched);
+
+    double startTime = getWallTime();
+    auto nodes = com.discoverNodes(1, 63);
+    double scanTime = getWallTime() - startTime;
+
+    std::vector<unsigned char> found;
+    for (const auto& n : nodes)
+    {
+        found.push_back(n.nodeNr);
+    }
+
+    std::cout << "  " << (batched ? "batched" : "one at a time") << ": " << scanTime * 1000 << " ms, found";
+    for (auto nr : found)
+    {
+        std::cout << " " << static_cast<int>(nr);
+    }
+    std::cout << "\n";
+
+    if (found != nodeNrs)
+    {
+        std::cout << "FAILED: discovered nodes do not match the emulated nodes\n";
+        return false;
+    }
+
+    // The nodes answer frames to 128 + their node number as repeated frames
+    if (batched && com.discoverNodes(1, 255).size() != nodeNrs.size())
+    {
+        std::cout << "FAILED: the scan up to node number 255 found repeated frame node numbers\n";
+        return false;
+    }
+    return true;
+}
+
+bool benchmarkStartup(const std::vector<std::vector<unsigned char> >& busNodeNrs)
+{
+    // 115200 baud with one start and one stop bit
+    std::vector<std::unique_ptr<PtyLoopback> > loopbacks;
+    std::vector<std::unique_ptr<SerialCommunication> > buses;
+    for (const auto& nodeNrs : busNodeNrs)
+    {
+        loopbacks.push_back(std::make_unique<PtyLoopback>(nodeNrs, 10.0 / 115200));
+        buses.push_back(std::make_unique<SerialCommunication>(loopbacks.back()->getDeviceName()));
+    }
+
+    size_t nrOfNodes = 0;
+    auto startManager = [&](std::shared_ptr<LinkCalibrationCache> cache)
+        {
+            double startTime = getWallTime();
+            ServoManager manager(0.01, [&]()
+                {
+                    std::vector<std::unique_ptr<DCServoCommunicator> > servos;
+                    for (size_t i = 0; i != busNodeNrs.size(); ++i)
+                    {
+                        for (auto nr : busNodeNrs[i])
+                        {
+                            servos.push_back(std::make_unique<DCServoCommunicator>(nr, buses[i].get()));
+                            servos.back()->setLinkCalibrationCache(cache);
+                        }
+                    }
+                    nrOfNodes = servos.size();
+                    return servos;
+                }, false);
+            return getWallTime() - startTime;
+        };
+
+    const std::string fileName = "/tmp/ServoProjectBenchmarkLinkCalibration.txt";
+    std::remove(fileName.c_str());
+
+    // The first start fills the link calibration cache, the second is a restart using it
+    double initTime = startManager(std::make_shared<LinkCalibrationCache>(fileName));
+    double cachedInitTime = startManager(std::make_shared<LinkCalibrationCache>(fileName));
+
+    // Entries with the wrong loop time, e.g. after changing the firmware, are replaced
+    auto cache = std::make_shared<LinkCalibrationCache>(fileName);
+    std::vector<LinkCalibrationCache::Entry> entries;
+    for (size_t i = 0; i != busNodeNrs.size(); ++i)
+    {
+        for (auto nr : busNodeNrs[i])
+        {
+            LinkCalibrationCache::Entry entry;
+            cache->get(buses[i]->getName(), nr, entry);
+            entries.push_back(entry);
+            entry.loopCycleTime *= 2;
+            cache->set(buses[i]->getName(), nr, entry);
+        }
+    }
+    double staleInitTime = startManager(cache);
+
+    bool staleEntriesReplaced = true;
+    auto entryIt = entries.begin();
+    for (size_t i = 0; i != busNodeNrs.size(); ++i)
+    {
+        for (auto nr : busNodeNrs[i])
+        {
+            LinkCalibrationCache::Entry entry;
+            cache->get(buses[i]->getName(), nr, entry);
+            staleEntriesReplaced = staleEntriesReplaced && entry.loopCycleTime == entryIt->loopCycleTime;
+            ++entryIt;
+        }
+    }
+    std::remove(fileName.c_str());
+
+    // A cache file that can not be written must not stop the start
+    auto unwritableCache = std::make_shared<LinkCalibrationCache>("/nonexistent/ServoProjectLinkCalibration.txt");
+    std::string unwritableCacheError;
+    try
+    {
+        startManager(unwritableCache);
+    }
+    catch (std::exception& e)
+    {
+        unwritableCacheError = e.what();
+    }
+
+    std::cout << "  " << nrOfNodes << " nodes on " << busNodeNrs.size() << " bus(es): "
+            << initTime * 1000 << " ms to ready, "
+            << cachedInitTime * 1000 << " ms with cached link calibration, "
+            << staleInitTime * 1000 << " ms with a wrong cached loop time\n";
+
+    if (!staleEntriesReplaced)
+    {
+        std::cout << "FAILED: cache entries with a wrong loop time were not replaced\n";
+        return false;
+    }
+
+    if (!unwritableCacheError.empty() || unwritableCache->getSaveError().empty())
+    {
+        std::cout << "FAILED: unwritable link calibration cache, " << unwritableCacheError << "\n";
+        return false;
+    }
+
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc > 1 && std::string(argv[1]) == "matrix")
+    {
+        benchmarkBusMatrix(argc > 2 ? std::stoul(argv[2]) : 100);
+        return 0;
+    }
+
+    size_t iterations = 10000;
+    if (argc > 1)
+    {
+        iterations = std::stoul(argv[1]);
+    }
+
+    benchmarkExecute(iterations);
+    benchmarkMultiBus(iterations / 100);
+
+    std::cout << "ServoManager startup at 115200 baud\n";
+    bool startupOk = benchmarkStartup({{1, 2, 3, 4, 5, 6, 7}});
+    startupOk = benchmarkStartup({{1, 2, 3, 4}, {5, 6, 7}}) && startupOk;
+    if (!startupOk)
+    {
+        return 1;
+    }
+
+    std::cout << "Node discovery scan of node numbers 1 to 63 at 115200 baud\n";
+    bool discoveryOk = benchmarkDiscovery(false);
+    discoveryOk = benchmarkDiscovery(true) && discoveryOk;
+    if (!discoveryOk)
+    {
+        return 1;
+    }
+
+    std::cout << "Bus bytes per cycle reading 11 registers, " << iterations / 10 << " cycles\n";
+    benchmarkPollingRates(iterations / 10, false, 1);
+    benchmarkPollingRates(iterations / 10, false);
+    benchmarkPollingRates(iterations / 10, true, 1);
+    benchmarkPollingRates(iterations / 10, true);
+
+    std::cout << "Bus bytes per cycle setting references on 7 nodes, " << iterations / 10 << " cycles\n";
+    benchmarkBroadcastReference(iterations / 10, 2);
+    benchmarkBroadcastReference(iterations / 10, 3);
+
+    std::cout << "7 nodes at 115200 baud with every 50th response failing, " << iterations / 10 << " cycles\n";
+    benchmarkErrorRecovery(iterations / 10, false);
+    benchmarkErrorRecovery(iterations / 10, true);
+    if (!checkRepeatedFrames(iterations / 30) || !checkTimedReferences(iterations / 30))
+    {
+        return 1;
+    }
+
+    std::cout << "7 nodes and one silent node at 115200 baud, " << iterations / 100 << " cycles\n";
+    benchmarkSilentNode(iterations / 100, false);
+    benchmarkSilentNode(iterations / 100, true);
+    if (!checkSlowNodeRecovery(iterations / 30))
+    {
+        return 1;
+    }
+
+    std::cout << "ServoManager with 4 ms cycle time, " << iterations / 10 << " cycles\n";
+    benchmarkWakeupJitter(iterations / 10, false);
+    benchmarkWakeupJitter(iterations / 10, true);
+
+    bool allocationFree = checkSteadyStateAllocations(iterations / 10, false);
+    allocationFree = checkSteadyStateAllocations(iterations / 10, true) && allocationFree;
+    allocationFree = checkManagerCycleAllocations(iterations / 100) && allocationFree;
+    if (!allocationFree)
+    {
+        std::cout << "FAILED: heap allocations in steady state cycle\n";
+        return 1;
+    }
+
+    if (!checkConcurrentStateReaders(iterations))
+    {
+        return 1;
+    }
+
+    if (!checkClockDriftTracking(iterations * 120) || !checkReferenceQueueTrajectory())
+    {
+        return 1;
+    }
+
+    if (!benchmarkTelemetryReplay(iterations / 10))
+    {
+        return 1;
+    }
+
+    return 0;
+}
@@ -141,7 +141,8 @@ void playTrajectory(ServoManager& manager,
 
     auto readResultHandlerFunction = [&](double dt, ServoManager& manager)
     {
-        std::vector<double> pos = manager.getPosition();
+        std::array<double, 2> pos{0};
+        manager.getPosition(pos);
 
         std::cout << std::fixed << std::setprecision(4);
         std::cout << "pos[0] = " << std::setw(7) << pos[0]
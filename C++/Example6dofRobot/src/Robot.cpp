@@ -5,7 +5,7 @@ double pi = M_PI;
 Robot::Robot(Communication* communication, const std::array<bool, 7> simulate, double cycleTime) :
         servoManager(cycleTime, [this, communication, &simulate](){
                 return this->initFunction(communication, simulate);
-            })
+            }, false)
 {
     auto& servos = servoManager.servos;
     for (size_t i = 0; i != dcServoArray.size(); ++i)
@@ -13,6 +13,15 @@ Robot::Robot(Communication* communication, const std::array<bool, 7> simulate, d
         dcServoArray[i] = servos[i].get();
     }
     gripperServo = servos[6].get();
+
+    for (size_t i = 0; i != 2; ++i)
+    {
+        gripperServo->setReference(pi / 2.0, 0.0, 0.0);
+        gripperServo->run();
+        gripperServo->getPosition();
+    }
+
+    servoManager.start();
 }
 
 Robot::~Robot()
@@ -60,18 +69,6 @@ std::vector<std::unique_ptr<DCServoCommunicator> > Robot::initFunction(
     //gripper servo handling
     servos[6]->setOffsetAndScaling(pi / 1900.0, 0.0, 0.0);
 
-    while (!servos[6]->isInitComplete())
-    {
-        servos[6]->run();
-    }
-
-    for (size_t i = 0; i != 2; ++i)
-    {
-        servos[6]->setReference(pi / 2.0, 0.0, 0.0);
-        servos[6]->run();
-        servos[6]->getPosition();
-    }
-
     return servos;
 }
 
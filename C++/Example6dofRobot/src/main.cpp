@@ -6,6 +6,7 @@
 #include "gui.h"
 
 #include <iostream>
+#include <algorithm>
 #include <numeric>
 #include <cmath>
 
@@ -648,7 +649,10 @@ int main(int argc, char* argv[])
     {
         try
         {
-            communication = std::make_unique<SerialCommunication>("/dev/ttyACM0");
+            auto serialCommunication = std::make_unique<SerialCommunication>("/dev/ttyACM0");
+            serialCommunication->enableErrorRecovery();
+            serialCommunication->enableAdaptiveTimeouts();
+            communication = std::move(serialCommunication);
         }
         catch (std::exception& e)
         {
@@ -657,6 +661,23 @@ int main(int argc, char* argv[])
 
             return 0;
         }
+
+        auto nodes = static_cast<SerialCommunication*>(communication.get())->discoverNodes(1, 7);
+        if (nodes.size() != 7)
+        {
+            std::cout << "missing servo nodes:";
+            for (unsigned char nr = 1; nr <= 7; ++nr)
+            {
+                if (std::none_of(nodes.begin(), nodes.end(),
+                        [nr](const SerialCommunication::DiscoveredNode& n){ return n.nodeNr == nr; }))
+                {
+                    std::cout << " " << static_cast<int>(nr);
+                }
+            }
+            std::cout << "\n";
+
+            return 0;
+        }
     }
 
     double comCycleTime = 0.018;
@@ -0,0 +1,41 @@
+#include <Arduino.h>
+
+#ifndef ADAFRUIT_DOTSTAR_H
+#define ADAFRUIT_DOTSTAR_H
+
+#define DOTSTAR_RGB (0 | (1 << 2) | (2 << 4))
+#define DOTSTAR_BGR (2 | (1 << 2) | (0 << 4))
+
+class Adafruit_DotStar
+{
+public:
+    Adafruit_DotStar(uint16_t n, uint8_t data, uint8_t clock, uint8_t order = DOTSTAR_BGR)
+    {
+    }
+
+    void begin()
+    {
+    }
+
+    void show()
+    {
+    }
+
+    void setPixelColor(uint16_t n, uint8_t r, uint8_t g, uint8_t b)
+    {
+    }
+
+    void setPixelColor(uint16_t n, uint32_t c)
+    {
+    }
+
+    void setBrightness(uint8_t brightness)
+    {
+    }
+
+    void clear()
+    {
+    }
+};
+
+#endif
@@ -0,0 +1,105 @@
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <cmath>
+#include <array>
+#include <sam.h>
+
+#ifndef ARDUINO_H
+#define ARDUINO_H
+
+#define INPUT 0x0
+#define OUTPUT 0x1
+#define INPUT_PULLUP 0x2
+#define INPUT_PULLDOWN 0x3
+
+#define LOW 0x0
+#define HIGH 0x1
+
+#define MSBFIRST 1
+#define LSBFIRST 0
+
+static const uint8_t A0 = 14;
+static const uint8_t A1 = 15;
+static const uint8_t A2 = 16;
+static const uint8_t A3 = 17;
+static const uint8_t A4 = 18;
+static const uint8_t A5 = 19;
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+void pinMode(uint32_t pin, uint32_t mode);
+void digitalWrite(uint32_t pin, uint32_t value);
+int digitalRead(uint32_t pin);
+int analogRead(uint32_t pin);
+void analogWrite(uint32_t pin, int value);
+
+class Stream
+{
+public:
+    virtual ~Stream()
+    {
+    }
+
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+    virtual size_t write(uint8_t byte) = 0;
+    virtual size_t write(const uint8_t* buffer, size_t size);
+
+    size_t write(const char* buffer, size_t size)
+    {
+        return write(reinterpret_cast<const uint8_t*>(buffer), size);
+    }
+
+    virtual void flush()
+    {
+    }
+
+    size_t readBytes(char* buffer, size_t length);
+
+    size_t readBytes(uint8_t* buffer, size_t length)
+    {
+        return readBytes(reinterpret_cast<char*>(buffer), length);
+    }
+};
+
+// Serial port backed by a file descriptor, typically the master side of a pseudo terminal.
+// A port that is not attached behaves like an unconnected serial line.
+class HardwareSerial : public Stream
+{
+public:
+    void begin(unsigned long baudRate);
+
+    void end();
+
+    void attach(int fd);
+
+    virtual int available() override;
+    virtual int read() override;
+    virtual int peek() override;
+    virtual size_t write(uint8_t byte) override;
+    virtual size_t write(const uint8_t* buffer, size_t size) override;
+    using Stream::write;
+
+    operator bool() const
+    {
+        return fd != -1;
+    }
+
+private:
+    void fillReceiveBuffer();
+
+    int fd{-1};
+    std::array<uint8_t, 256> receiveBuffer;
+    size_t receiveBegin{0};
+    size_t receiveEnd{0};
+};
+
+extern HardwareSerial Serial;
+extern HardwareSerial Serial1;
+
+#endif
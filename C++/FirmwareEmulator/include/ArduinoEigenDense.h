@@ -0,0 +1 @@
+#include <Eigen/Dense>
@@ -0,0 +1,52 @@
+#include <Arduino.h>
+
+#ifndef SPI_H
+#define SPI_H
+
+#define SPI_MODE0 0x02
+#define SPI_MODE1 0x00
+#define SPI_MODE2 0x03
+#define SPI_MODE3 0x01
+
+class SPISettings
+{
+public:
+    SPISettings(uint32_t clock, uint8_t bitOrder, uint8_t dataMode)
+    {
+    }
+};
+
+// No SPI devices are connected on the host, transfers read back zero
+class SPIClass
+{
+public:
+    void begin()
+    {
+    }
+
+    void end()
+    {
+    }
+
+    void beginTransaction(SPISettings settings)
+    {
+    }
+
+    void endTransaction()
+    {
+    }
+
+    uint8_t transfer(uint8_t data)
+    {
+        return 0;
+    }
+
+    uint16_t transfer16(uint16_t data)
+    {
+        return 0;
+    }
+};
+
+extern SPIClass SPI;
+
+#endif
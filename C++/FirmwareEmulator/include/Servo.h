@@ -0,0 +1,33 @@
+#include <Arduino.h>
+
+#ifndef SERVO_H
+#define SERVO_H
+
+class Servo
+{
+public:
+    uint8_t attach(int pin, int min = 544, int max = 2400)
+    {
+        isAttached = true;
+        return 0;
+    }
+
+    void detach()
+    {
+        isAttached = false;
+    }
+
+    void writeMicroseconds(int value)
+    {
+    }
+
+    bool attached()
+    {
+        return isAttached;
+    }
+
+private:
+    bool isAttached{false};
+};
+
+#endif
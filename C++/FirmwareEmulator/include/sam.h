@@ -0,0 +1,67 @@
+#include <cstdint>
+
+#ifndef SAM_H
+#define SAM_H
+
+#define ADC_CTRLB_PRESCALER_DIV4_Val 0x0ul
+#define ADC_CTRLB_PRESCALER_DIV8_Val 0x1ul
+#define ADC_CTRLB_PRESCALER_DIV16_Val 0x2ul
+#define ADC_CTRLB_PRESCALER_DIV32_Val 0x3ul
+#define ADC_CTRLB_PRESCALER_DIV64_Val 0x4ul
+#define ADC_CTRLB_PRESCALER_DIV128_Val 0x5ul
+#define ADC_CTRLB_PRESCALER_DIV256_Val 0x6ul
+#define ADC_CTRLB_PRESCALER_DIV512_Val 0x7ul
+
+#define ADC_CTRLB_RESSEL_12BIT_Val 0x0ul
+#define ADC_CTRLB_RESSEL_16BIT_Val 0x1ul
+#define ADC_CTRLB_RESSEL_10BIT_Val 0x2ul
+#define ADC_CTRLB_RESSEL_8BIT_Val 0x3ul
+
+#define ADC_AVGCTRL_SAMPLENUM_1_Val 0x0ul
+#define ADC_AVGCTRL_SAMPLENUM_2_Val 0x1ul
+#define ADC_AVGCTRL_SAMPLENUM_4_Val 0x2ul
+#define ADC_AVGCTRL_SAMPLENUM_8_Val 0x3ul
+#define ADC_AVGCTRL_SAMPLENUM_16_Val 0x4ul
+#define ADC_AVGCTRL_SAMPLENUM_32_Val 0x5ul
+#define ADC_AVGCTRL_SAMPLENUM_64_Val 0x6ul
+#define ADC_AVGCTRL_SAMPLENUM_128_Val 0x7ul
+#define ADC_AVGCTRL_SAMPLENUM_256_Val 0x8ul
+#define ADC_AVGCTRL_SAMPLENUM_512_Val 0x9ul
+#define ADC_AVGCTRL_SAMPLENUM_1024_Val 0xAul
+
+// Timer/counter registers are never touched on the host, the type is only used for pointers
+struct Tcc;
+
+// Port registers accept writes but have no effect on the host
+struct PortGroup
+{
+    union
+    {
+        struct
+        {
+            uint8_t PMUXEN:1;
+            uint8_t INEN:1;
+            uint8_t PULLEN:1;
+            uint8_t :3;
+            uint8_t DRVSTR:1;
+            uint8_t :1;
+        } bit;
+        uint8_t reg;
+    } PINCFG[32];
+
+    struct
+    {
+        uint32_t reg;
+    } OUTSET, OUTCLR, DIRSET, DIRCLR;
+};
+
+struct Port
+{
+    PortGroup Group[2];
+};
+
+extern Port hostPortRegisters;
+
+#define PORT (&hostPortRegisters)
+
+#endif
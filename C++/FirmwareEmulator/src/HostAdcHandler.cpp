@@ -0,0 +1,181 @@
+#include "src/Hardware/AdcHandler.h"
+
+// Host replacement for AdcHandler.cpp. There is no ADC on the host, every conversion
+// completes directly when it is started and reads back analogRead() of the pin.
+
+AdcSamplerInstance::AdcSamplerInstance(uint32_t p) :
+    pin(p)
+{
+    if (pin < A0) {
+        pin += A0;
+    }
+}
+
+AdcSamplerInstance::~AdcSamplerInstance()
+{
+    unlockFromAdc();
+}
+
+void AdcSamplerInstance::getAdcLockAndStartSampling()
+{
+    bool startSampling = false;
+
+    if (!pendingInQueue)
+    {
+        pendingInQueue = true;
+        if (AdcHandler::endOfQueueInstance == nullptr)
+        {
+            AdcHandler::endOfQueueInstance = this;
+            AdcHandler::activeInstance = this;
+            startSampling = true;
+        }
+        else
+        {
+            auto currentEnd = AdcHandler::endOfQueueInstance;
+            currentEnd->nextQueued = this;
+            this->preQueued = currentEnd;
+            AdcHandler::endOfQueueInstance = this;
+        }
+    }
+
+    if (startSampling)
+    {
+        loadConfigAndStart();
+    }
+}
+
+void AdcSamplerInstance::unlockFromAdc()
+{
+}
+
+bool AdcSamplerInstance::sampleReady()
+{
+    return !pendingInQueue;
+}
+
+void AdcSamplerInstance::startAdcSample()
+{
+    ADC_Handler();
+}
+
+AdcSamplerInstance* AdcHandler::activeInstance = nullptr;
+AdcSamplerInstance* AdcHandler::endOfQueueInstance = nullptr;
+
+void AdcHandler::init()
+{
+}
+
+void ADC_Handler()
+{
+    auto currentActive = AdcHandler::activeInstance;
+    if (currentActive == nullptr)
+    {
+        return;
+    }
+
+    if (currentActive->handleResultAndCleanUp(analogRead(currentActive->pin)))
+    {
+        auto nextActive = currentActive->nextQueued;
+        if (nextActive != nullptr)
+        {
+            nextActive->preQueued = nullptr;
+            currentActive->nextQueued = nullptr;
+            AdcHandler::activeInstance = nextActive;
+            currentActive->pendingInQueue = false;
+
+            AdcHandler::activeInstance->loadConfigAndStart();
+            return;
+        }
+
+        AdcHandler::activeInstance = nullptr;
+        AdcHandler::endOfQueueInstance = nullptr;
+        currentActive->pendingInQueue = false;
+
+        currentActive->handleRetriggering();
+    }
+    else
+    {
+        ADC_Handler();
+    }
+}
+
+AnalogSampler::AnalogSampler(uint32_t pin, uint8_t prescalerDivEnum) :
+    AdcSamplerInstance(pin),
+    prescalerDivEnum(prescalerDivEnum)
+{
+}
+
+AnalogSampler::~AnalogSampler()
+{
+}
+
+void AnalogSampler::triggerSample(uint8_t sampleNrEnum)
+{
+    this->sampleNrEnum = sampleNrEnum;
+    autoRetrigger = false;
+    AdcSamplerInstance::getAdcLockAndStartSampling();
+}
+
+void AnalogSampler::startAutoSampling(uint8_t sampleNrEnum)
+{
+    // Retriggering from the completion handler would never return on the host,
+    // so auto sampling is emulated by sampling on every read instead
+    this->sampleNrEnum = sampleNrEnum;
+    autoRetrigger = true;
+    AdcSamplerInstance::getAdcLockAndStartSampling();
+}
+
+int32_t AnalogSampler::getValue()
+{
+    if (autoRetrigger)
+    {
+        AdcSamplerInstance::getAdcLockAndStartSampling();
+    }
+    return value;
+}
+
+void AnalogSampler::loadConfigAndStart()
+{
+    AdcSamplerInstance::startAdcSample();
+}
+
+bool AnalogSampler::handleResultAndCleanUp(int32_t result)
+{
+    // Results are scaled to the 16 bit accumulated format used on the target
+    value = result << 4;
+    return true;
+}
+
+void AnalogSampler::handleRetriggering()
+{
+}
+
+AverageAnalogSampler::AverageAnalogSampler(uint32_t pin) :
+    AdcSamplerInstance(pin)
+{
+}
+
+AverageAnalogSampler::~AverageAnalogSampler()
+{
+}
+
+void AverageAnalogSampler::triggerSample()
+{
+    AdcSamplerInstance::getAdcLockAndStartSampling();
+}
+
+int32_t AverageAnalogSampler::getValue()
+{
+    return value;
+}
+
+void AverageAnalogSampler::loadConfigAndStart()
+{
+    AdcSamplerInstance::startAdcSample();
+}
+
+bool AverageAnalogSampler::handleResultAndCleanUp(int32_t result)
+{
+    value = result << 4;
+    return true;
+}
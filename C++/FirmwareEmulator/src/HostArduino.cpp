@@ -0,0 +1,173 @@
+#include <Arduino.h>
+#include <SPI.h>
+#include <sam.h>
+
+#include <chrono>
+#include <thread>
+#include <poll.h>
+#include <unistd.h>
+
+static const auto startTime = std::chrono::steady_clock::now();
+
+unsigned long millis()
+{
+    using namespace std::chrono;
+    return static_cast<unsigned long>(static_cast<uint32_t>(
+            duration_cast<milliseconds>(steady_clock::now() - startTime).count()));
+}
+
+unsigned long micros()
+{
+    using namespace std::chrono;
+    return static_cast<unsigned long>(static_cast<uint32_t>(
+            duration_cast<microseconds>(steady_clock::now() - startTime).count()));
+}
+
+void delay(unsigned long ms)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+void delayMicroseconds(unsigned int us)
+{
+    std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
+
+void pinMode(uint32_t pin, uint32_t mode)
+{
+}
+
+void digitalWrite(uint32_t pin, uint32_t value)
+{
+}
+
+int digitalRead(uint32_t pin)
+{
+    return LOW;
+}
+
+int analogRead(uint32_t pin)
+{
+    return 0;
+}
+
+void analogWrite(uint32_t pin, int value)
+{
+}
+
+size_t Stream::write(const uint8_t* buffer, size_t size)
+{
+    size_t n = 0;
+    while (n != size && write(buffer[n]) == 1)
+    {
+        ++n;
+    }
+    return n;
+}
+
+size_t Stream::readBytes(char* buffer, size_t length)
+{
+    size_t n = 0;
+    while (n != length && available() > 0)
+    {
+        buffer[n] = static_cast<char>(read());
+        ++n;
+    }
+    return n;
+}
+
+void HardwareSerial::begin(unsigned long baudRate)
+{
+}
+
+void HardwareSerial::end()
+{
+}
+
+void HardwareSerial::attach(int fd)
+{
+    this->fd = fd;
+    receiveBegin = 0;
+    receiveEnd = 0;
+}
+
+int HardwareSerial::available()
+{
+    fillReceiveBuffer();
+    return static_cast<int>(receiveEnd - receiveBegin);
+}
+
+int HardwareSerial::read()
+{
+    fillReceiveBuffer();
+    if (receiveBegin == receiveEnd)
+    {
+        return -1;
+    }
+    return receiveBuffer[receiveBegin++];
+}
+
+int HardwareSerial::peek()
+{
+    fillReceiveBuffer();
+    if (receiveBegin == receiveEnd)
+    {
+        return -1;
+    }
+    return receiveBuffer[receiveBegin];
+}
+
+size_t HardwareSerial::write(uint8_t byte)
+{
+    return write(&byte, 1);
+}
+
+size_t HardwareSerial::write(const uint8_t* buffer, size_t size)
+{
+    if (fd == -1)
+    {
+        return size;
+    }
+
+    size_t n = 0;
+    while (n != size)
+    {
+        ssize_t written = ::write(fd, buffer + n, size - n);
+        if (written <= 0)
+        {
+            break;
+        }
+        n += written;
+    }
+    return n;
+}
+
+void HardwareSerial::fillReceiveBuffer()
+{
+    if (fd == -1 || receiveBegin != receiveEnd)
+    {
+        return;
+    }
+
+    receiveBegin = 0;
+    receiveEnd = 0;
+
+    pollfd pollFd{fd, POLLIN, 0};
+    if (::poll(&pollFd, 1, 0) <= 0 || (pollFd.revents & POLLIN) == 0)
+    {
+        return;
+    }
+
+    ssize_t bytesRead = ::read(fd, receiveBuffer.data(), receiveBuffer.size());
+    if (bytesRead > 0)
+    {
+        receiveEnd = bytesRead;
+    }
+}
+
+HardwareSerial Serial;
+HardwareSerial Serial1;
+
+SPIClass SPI;
+
+Port hostPortRegisters;
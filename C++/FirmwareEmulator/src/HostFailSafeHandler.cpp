@@ -0,0 +1,32 @@
+#include "src/Hardware/FailSafeHandler.h"
+
+#include <iostream>
+
+// Host replacement for FailSafeHandler.cpp. The host scheduler can delay a control loop
+// cycle beyond its period without any fault in the firmware, so an overrun is reported
+// instead of halting the emulated node. There is no watchdog thread for the same reason.
+
+FailSafeHandler* FailSafeHandler::getInstance()
+{
+    static FailSafeHandler failSafeHandler;
+    return &failSafeHandler;
+}
+
+void FailSafeHandler::resetWatchdogTimer()
+{
+    watchdogReset = true;
+}
+
+void FailSafeHandler::goToFailSafe()
+{
+    if (!failSafeTriggered)
+    {
+        std::cerr << "Fail safe triggered, control loop cycle overrun\n";
+    }
+    failSafeTriggered = true;
+}
+
+FailSafeHandler::FailSafeHandler() :
+    failSafeThread(nullptr)
+{
+}
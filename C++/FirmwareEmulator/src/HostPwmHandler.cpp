@@ -0,0 +1,30 @@
+#include "src/Hardware/PwmHandler.h"
+
+// Host replacement for PwmHandler.cpp. Only the hardware independent base class is
+// provided, the H-bridge drivers need the timer peripherals of the target.
+
+PwmHandler::PwmHandler()
+{
+    pwmHandlers.push_back(this);
+}
+
+PwmHandler::~PwmHandler()
+{
+    pwmHandlers.erase(std::remove(std::begin(pwmHandlers), std::end(pwmHandlers), this),
+        std::end(pwmHandlers));
+}
+
+void PwmHandler::addDamping(bool b)
+{
+    damping = b;
+}
+
+void PwmHandler::disconnectAllOutputs()
+{
+    for (auto pwmHandler : pwmHandlers)
+    {
+        pwmHandler->disconnectOutput();
+    }
+}
+
+std::vector<PwmHandler*> PwmHandler::pwmHandlers;
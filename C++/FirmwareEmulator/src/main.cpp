@@ -0,0 +1,254 @@
+#include "src/ArduinoC++BugFixes.h"
+#include "src/Hardware/ThreadHandler.h"
+#include "config/defaultSim.h"
+
+#include <iostream>
+#include <cstdlib>
+#include <csignal>
+#include <pty.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+SET_THREAD_HANDLER_TICK(200);
+THREAD_HANDLER_WITH_EXECUTION_ORDER_OPTIMIZED(InterruptTimer::getInstance());
+
+// The simulation config ships without encoder calibration, which divides by zero when the
+// calibration is scaled. The target silently returns zero for that, the host traps, so the
+// emulated node is calibrated with the sensor curves of the simulated plant instead.
+class EmulatorConfigHolder : public SetupConfigHolder
+{
+public:
+    static std::unique_ptr<OpticalEncoderHandler> createMainEncoderHandler()
+    {
+        return std::make_unique<OpticalEncoderSim>(simHandler, SimulationHandler::aVec, SimulationHandler::bVec,
+                A3, A4, 4096.0f * 10.0f / 1 * 11.0f / 62 * 14.0f / 48 * 13.0f / 45 * 1.0f / 42);
+    }
+};
+
+// Counts the com cycles, the applied frames and the references of the node, which the host
+// can compare with the frames it sent to check that no frame is applied twice and that no
+// reference leaves the timed reference mode
+class CountingCommunicationHandler : public DCServoCommunicationHandler
+{
+public:
+    using DCServoCommunicationHandler::DCServoCommunicationHandler;
+
+    virtual void onReceiveCompleteEvent() override
+    {
+        ++appliedFrames;
+        if (intArrayChanged[0])
+        {
+            ++(charArrayChanged[13] ? timedReferences : untimedReferences);
+        }
+        DCServoCommunicationHandler::onReceiveCompleteEvent();
+    }
+
+    virtual void onComCycleEvent() override
+    {
+        ++comCycles;
+        DCServoCommunicationHandler::onComCycleEvent();
+    }
+
+    size_t appliedFrames{0};
+    size_t comCycles{0};
+    size_t timedReferences{0};
+    size_t untimedReferences{0};
+};
+
+// Passes the data between the pseudo terminal and the firmware and drops the response to
+// every interval:th frame, as if it was lost on the bus. The frames reach the firmware.
+class ResponseDropper
+{
+public:
+    ResponseDropper(int hostFd, int firmwareFd, int interval) :
+        hostFd(hostFd), firmwareFd(firmwareFd), interval(interval)
+    {
+    }
+
+    void run()
+    {
+        std::array<unsigned char, 256> buffer;
+
+        ssize_t size = readAvailable(hostFd, buffer);
+        for (ssize_t i = 0; i < size; ++i)
+        {
+            if (frameBytes == 0)
+            {
+                frameNodeNr = buffer[i];
+                dropResponse = false;
+            }
+            ++frameBytes;
+            if (frameBytes == 3)
+            {
+                frameSize = 3 + buffer[i];
+            }
+
+            // Broadcast and repeated frames are not counted
+            if (frameBytes >= 3 && frameBytes == frameSize)
+            {
+                if (frameNodeNr != 0 && frameNodeNr < 128 && ++frameCount % interval == 0)
+                {
+                    dropResponse = true;
+                    ++droppedResponses;
+                }
+                frameBytes = 0;
+            }
+        }
+        writeAll(firmwareFd, buffer.data(), size);
+
+        size = readAvailable(firmwareFd, buffer);
+        if (!dropResponse)
+        {
+            writeAll(hostFd, buffer.data(), size);
+        }
+    }
+
+    size_t droppedResponses{0};
+
+private:
+    static ssize_t readAvailable(int fd, std::array<unsigned char, 256>& buffer)
+    {
+        pollfd pollFd{fd, POLLIN, 0};
+        if (::poll(&pollFd, 1, 0) <= 0 || (pollFd.revents & POLLIN) == 0)
+        {
+            return 0;
+        }
+        return std::max(::read(fd, buffer.data(), buffer.size()), ssize_t{0});
+    }
+
+    static void writeAll(int fd, const unsigned char* data, ssize_t size)
+    {
+        while (size > 0)
+        {
+            ssize_t written = ::write(fd, data, size);
+            if (written <= 0)
+            {
+                break;
+            }
+            data += written;
+            size -= written;
+        }
+    }
+
+    int hostFd;
+    int firmwareFd;
+    int interval;
+    size_t frameBytes{0};
+    size_t frameSize{0};
+    unsigned char frameNodeNr{0};
+    size_t frameCount{0};
+    bool dropResponse{false};
+};
+
+static volatile std::sig_atomic_t shuttingDown = 0;
+
+static void signalHandler(int)
+{
+    shuttingDown = 1;
+}
+
+int main(int argc, char* argv[])
+{
+    int nodeNr = 1;
+    if (argc > 1)
+    {
+        nodeNr = std::atoi(argv[1]);
+    }
+    int dropInterval = 0;
+    if (argc > 2)
+    {
+        dropInterval = std::atoi(argv[2]);
+    }
+    if (nodeNr < 1 || nodeNr > 127 || dropInterval < 0)
+    {
+        std::cerr << "Usage: " << argv[0] << " [node number 1-127] [drop the response to every nth frame]\n";
+        return 1;
+    }
+
+    int masterFd;
+    int slaveFd;
+    std::array<char, 256> name{{0}};
+    if (::openpty(&masterFd, &slaveFd, name.data(), nullptr, nullptr) != 0)
+    {
+        std::cerr << "Could not open pseudo terminal\n";
+        return 1;
+    }
+
+    termios settings;
+    ::tcgetattr(slaveFd, &settings);
+    ::cfmakeraw(&settings);
+    ::tcsetattr(slaveFd, TCSANOW, &settings);
+
+    std::array<int, 2> firmwareFds{{-1, -1}};
+    std::unique_ptr<ResponseDropper> responseDropper;
+    if (dropInterval != 0)
+    {
+        if (::socketpair(AF_UNIX, SOCK_STREAM, 0, firmwareFds.data()) != 0)
+        {
+            std::cerr << "Could not open socket pair\n";
+            return 1;
+        }
+        responseDropper = std::make_unique<ResponseDropper>(masterFd, firmwareFds[1], dropInterval);
+        Serial1.attach(firmwareFds[0]);
+    }
+    else
+    {
+        Serial1.attach(masterFd);
+    }
+    Serial1.begin(115200);
+
+    auto node = std::make_unique<CountingCommunicationHandler>(nodeNr, createDCServo<EmulatorConfigHolder>());
+    const CountingCommunicationHandler& nodeCounts = *node;
+    auto communication = std::make_unique<Communication>(SerialComOptimizer(&Serial1, &Serial));
+    communication->addCommunicationNode(std::move(node));
+
+    std::signal(SIGINT, signalHandler);
+    std::signal(SIGTERM, signalHandler);
+
+    std::cout << name.data() << std::endl;
+
+    ThreadHandler::getInstance()->enableThreadExecution();
+
+    while (!shuttingDown)
+    {
+        uint32_t timeToNextTick = InterruptTimer::runDueInterrupt();
+
+        if (responseDropper)
+        {
+            responseDropper->run();
+        }
+
+        communication->run();
+
+        if (timeToNextTick != 0 && Serial1.available() == 0)
+        {
+            std::array<pollfd, 2> pollFds{{{masterFd, POLLIN, 0}, {firmwareFds[1], POLLIN, 0}}};
+            timespec timeout{0, static_cast<long>(timeToNextTick) * 1000};
+            ::ppoll(pollFds.data(), responseDropper ? 2 : 1, &timeout, nullptr);
+        }
+    }
+
+    ThreadHandler::getInstance()->enableThreadExecution(false);
+
+    std::cout << "com cycles: " << nodeCounts.comCycles << ", applied frames: " << nodeCounts.appliedFrames;
+    if (responseDropper)
+    {
+        std::cout << ", dropped responses: " << responseDropper->droppedResponses;
+    }
+    std::cout << ", timed references: " << nodeCounts.timedReferences
+            << ", untimed references: " << nodeCounts.untimedReferences << std::endl;
+
+    for (int fd : firmwareFds)
+    {
+        if (fd != -1)
+        {
+            ::close(fd);
+        }
+    }
+    ::close(slaveFd);
+    ::close(masterFd);
+
+    return 0;
+}
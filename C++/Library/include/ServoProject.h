@@ -2,7 +2,16 @@
 #include <array>
 #include <vector>
 #include <exception>
+#include <stdexcept>
 #include <sstream>
+#include <algorithm>
+
+#include <chrono>
+#include <atomic>
+#include <thread>
+#include <cstdint>
+#include <memory>
+#include <limits>
 
 #include <boost/asio.hpp>
 #include <boost/asio/serial_port.hpp> 
@@ -38,6 +47,358 @@ public:
     ErrorCode code;
 };
 
+template <typename T, size_t N>
+class FixedCapacityVector
+{
+public:
+    using iterator = T*;
+    using const_iterator = const T*;
+
+    T* begin() {return elements.data();}
+    T* end() {return elements.data() + nrOfElements;}
+    const T* begin() const {return elements.data();}
+    const T* end() const {return elements.data() + nrOfElements;}
+    const T* cbegin() const {return begin();}
+    const T* cend() const {return end();}
+
+    T* data() {return elements.data();}
+    const T* data() const {return elements.data();}
+
+    T& operator[] (size_t i) {return elements[i];}
+    const T& operator[] (size_t i) const {return elements[i];}
+
+    size_t size() const {return nrOfElements;}
+    static constexpr size_t capacity() {return N;}
+    bool empty() const {return nrOfElements == 0;}
+    bool full() const {return nrOfElements == N;}
+
+    void clear()
+    {
+        nrOfElements = 0;
+    }
+
+    void push_back(const T& value)
+    {
+        if (full())
+        {
+            throw std::length_error("FixedCapacityVector capacity exceeded");
+        }
+        elements[nrOfElements] = value;
+        ++nrOfElements;
+    }
+
+    template <typename InputIt>
+    void append(InputIt first, InputIt last)
+    {
+        for (; first != last; ++first)
+        {
+            push_back(*first);
+        }
+    }
+
+private:
+    std::array<T, N> elements;
+    size_t nrOfElements{0};
+};
+
+template <typename T>
+class Span
+{
+public:
+    Span(T* data, size_t size) :
+        elements(data), nrOfElements(size)
+    {
+    }
+
+    template <typename Container>
+    Span(Container& container) :
+        elements(container.data()), nrOfElements(container.size())
+    {
+    }
+
+    T* begin() const {return elements;}
+    T* end() const {return elements + nrOfElements;}
+    T* data() const {return elements;}
+    size_t size() const {return nrOfElements;}
+    T& operator[] (size_t i) const {return elements[i];}
+
+private:
+    T* elements;
+    size_t nrOfElements;
+};
+
+// Wait-free transfer of values from one writer thread to one reader thread. The writer
+// fills getWriteBuffer() and calls publish(), the reader gets the latest published
+// value from getReadBuffer(). Neither side ever waits for the other.
+template <typename T>
+class TripleBuffer
+{
+public:
+    // Not thread safe, only to be used before the buffer is shared
+    void initialize(const T& value)
+    {
+        buffers.fill(value);
+    }
+
+    T& getWriteBuffer() {return buffers[writeIndex];}
+
+    void publish()
+    {
+        writeIndex = middleIndex.exchange(writeIndex | newDataFlag, std::memory_order_acq_rel) & indexMask;
+    }
+
+    const T& getReadBuffer()
+    {
+        if (middleIndex.load(std::memory_order_relaxed) & newDataFlag)
+        {
+            readIndex = middleIndex.exchange(readIndex, std::memory_order_acq_rel) & indexMask;
+        }
+        return buffers[readIndex];
+    }
+
+private:
+    static constexpr unsigned char indexMask = 3;
+    static constexpr unsigned char newDataFlag = 4;
+
+    std::array<T, 3> buffers;
+    unsigned char writeIndex{0};
+    std::atomic<unsigned char> middleIndex{1};
+    unsigned char readIndex{2};
+};
+
+// Transfer of values from one writer thread to several reader threads through one triple
+// buffer per reader slot. The writer publishes to all slots, a reader claims a free slot
+// for the duration of its read. Up to nrOfReaderSlots threads read at the same time
+// without waiting, further readers wait until a slot is released.
+template <typename T, size_t nrOfReaderSlots>
+class MultiReaderTripleBuffer
+{
+public:
+    // Not thread safe, only to be used before the buffer is shared
+    void initialize(const T& value)
+    {
+        for (auto& slot : slots)
+        {
+            slot.buffer.initialize(value);
+        }
+    }
+
+    // Only to be called from the writer thread, writeFunction is called once per slot
+    template <typename Function>
+    void write(Function writeFunction)
+    {
+        for (auto& slot : slots)
+        {
+            writeFunction(slot.buffer.getWriteBuffer());
+            slot.buffer.publish();
+        }
+    }
+
+    template <typename Function>
+    void read(Function readFunction) const
+    {
+        while (true)
+        {
+            for (auto& slot : slots)
+            {
+                if (!slot.inUse.exchange(true, std::memory_order_acquire))
+                {
+                    readFunction(slot.buffer.getReadBuffer());
+                    slot.inUse.store(false, std::memory_order_release);
+                    return;
+                }
+            }
+            std::this_thread::yield();
+        }
+    }
+
+private:
+    struct ReaderSlot
+    {
+        TripleBuffer<T> buffer;
+        std::atomic<bool> inUse{false};
+    };
+
+    mutable std::array<ReaderSlot, nrOfReaderSlots> slots;
+};
+
+// Wait-free queue from one producer thread to one consumer thread. The capacity is
+// allocated at construction, push() returns false when the queue is full.
+template <typename T>
+class SpscQueue
+{
+public:
+    SpscQueue(size_t capacity) :
+        buffer(capacity + 1)
+    {
+    }
+
+    // Producer side
+    bool push(const T& value)
+    {
+        size_t t = tail.load(std::memory_order_relaxed);
+        size_t next = increment(t);
+        if (next == head.load(std::memory_order_acquire))
+        {
+            return false;
+        }
+        buffer[t] = value;
+        tail.store(next, std::memory_order_release);
+        return true;
+    }
+
+    // Producer side, returns the number of pushed values
+    size_t push(Span<const T> values)
+    {
+        size_t t = tail.load(std::memory_order_relaxed);
+        size_t h = head.load(std::memory_order_acquire);
+        size_t free = (h + buffer.size() - t - 1) % buffer.size();
+        size_t count = std::min(free, values.size());
+        for (size_t i = 0; i != count; ++i)
+        {
+            buffer[t] = values[i];
+            t = increment(t);
+        }
+        tail.store(t, std::memory_order_release);
+        return count;
+    }
+
+    // Consumer side
+    bool empty() const
+    {
+        return head.load(std::memory_order_relaxed) == tail.load(std::memory_order_acquire);
+    }
+
+    // Consumer side, only valid if the queue is not empty
+    const T& front() const
+    {
+        return buffer[head.load(std::memory_order_relaxed)];
+    }
+
+    // Consumer side, only valid if the queue is not empty
+    void pop()
+    {
+        head.store(increment(head.load(std::memory_order_relaxed)), std::memory_order_release);
+    }
+
+    // Approximate if called while the other side is active
+    size_t size() const
+    {
+        return (tail.load(std::memory_order_acquire) + buffer.size() -
+                head.load(std::memory_order_acquire)) % buffer.size();
+    }
+
+    size_t capacity() const
+    {
+        return buffer.size() - 1;
+    }
+
+private:
+    size_t increment(size_t i) const
+    {
+        return i + 1 == buffer.size() ? 0 : i + 1;
+    }
+
+    std::vector<T> buffer;
+    alignas(64) std::atomic<size_t> head{0};
+    alignas(64) std::atomic<size_t> tail{0};
+};
+
+class LatencyStatistics
+{
+public:
+    uint64_t count{0};
+    double mean{0.0};
+    double p50{0.0};
+    double p99{0.0};
+    double p999{0.0};
+    double max{0.0};
+};
+
+// Histogram of durations with logarithmic buckets of about 3 % relative width.
+// record() is lock free and meant to be called from one thread, getStatistics()
+// can be called from any other thread without blocking the recording thread.
+class LatencyHistogram
+{
+public:
+    void record(double seconds);
+
+    LatencyStatistics getStatistics() const;
+
+private:
+    static constexpr int subBucketBits = 6;
+    static constexpr size_t subBucketCount = 1 << subBucketBits;
+    static constexpr size_t subBucketHalfCount = subBucketCount / 2;
+    static constexpr size_t bucketCount = (64 - subBucketBits + 2) * subBucketHalfCount;
+
+    static size_t getBucketIndex(uint64_t nanoseconds);
+
+    static uint64_t getBucketValue(size_t index);
+
+    std::array<std::atomic<uint64_t>, bucketCount> buckets{};
+    std::atomic<uint64_t> count{0};
+    std::atomic<uint64_t> sum{0};
+    std::atomic<uint64_t> max{0};
+};
+
+class CommunicationStatus
+{
+public:
+    // False if the last transaction failed, the node's read values are then from an earlier transaction
+    bool lastTransactionOk{false};
+
+    // Failed responses, including the ones that succeeded when retried
+    size_t errorCount{0};
+    size_t retryCount{0};
+    size_t consecutiveFailures{0};
+};
+
+// Time source of the servo manager, the simulated buses and the servos' time synchronization
+class Clock
+{
+public:
+    virtual ~Clock(){}
+
+    virtual std::chrono::steady_clock::time_point now() const = 0;
+
+    virtual void sleepUntil(std::chrono::steady_clock::time_point timePoint) = 0;
+
+    // True if the clock does not follow real time
+    virtual bool isVirtual() const = 0;
+};
+
+class SteadyClock : public Clock
+{
+public:
+    // Instance shared by all real buses
+    static std::shared_ptr<Clock> getInstance();
+
+    virtual std::chrono::steady_clock::time_point now() const override;
+
+    virtual void sleepUntil(std::chrono::steady_clock::time_point timePoint) override;
+
+    virtual bool isVirtual() const override;
+};
+
+// Starts at the clock epoch and only moves when slept on, or when advanced, so a servo
+// manager where all buses are simulated on the same virtual clock runs as fast as the CPU
+// allows and gives the same result on every run
+class VirtualClock : public Clock
+{
+public:
+    virtual std::chrono::steady_clock::time_point now() const override;
+
+    // Returns immediately after advancing the clock to timePoint
+    virtual void sleepUntil(std::chrono::steady_clock::time_point timePoint) override;
+
+    virtual bool isVirtual() const override;
+
+    void advance(std::chrono::steady_clock::duration duration);
+
+private:
+    std::atomic<std::chrono::steady_clock::rep> ticks{0};
+};
+
 class Communication
 {
 public:
@@ -54,11 +415,39 @@ public:
 
     virtual void requestReadInt(unsigned char nr) = 0;
 
+    // Reads count consecutive registers starting at nr in one command,
+    // requires breaking change number 2 or higher in the node
+    virtual void requestReadCharBlock(unsigned char nr, unsigned char count) = 0;
+
+    virtual void requestReadIntBlock(unsigned char nr, unsigned char count) = 0;
+
     virtual char getLastReadChar(unsigned char nr) = 0;
 
     virtual short int getLastReadInt(unsigned char nr) = 0;
 
     virtual void execute() = 0;
+
+    virtual void queueExecute() = 0;
+
+    virtual void executeQueue() = 0;
+
+    virtual double getLastTransactionTime(unsigned char nr) = 0;
+
+    // Writes int 0 to 2 of the current node through a broadcast frame sent ahead of the
+    // queued frames, requires breaking change number 3 or higher in the node. Returns false
+    // if broadcast frames are not used, the values then have to be written in the node's own frame
+    virtual bool writeBroadcastReference(short int position, short int velocity, short int feedforward) = 0;
+
+    // Failed transactions are only retried if they are expected to complete before the deadline
+    virtual void setTransactionDeadline(std::chrono::steady_clock::time_point deadline) = 0;
+
+    virtual CommunicationStatus getCommunicationStatus(unsigned char nr) = 0;
+
+    // Time source of the nodes on the bus
+    virtual std::shared_ptr<Clock> getClock() const;
+
+    // Name of the port, empty if the bus has no persistent name
+    virtual std::string getName() const;
 };
 
 class SerialCommunication : public Communication
@@ -80,47 +469,262 @@ public:
 
     virtual void requestReadInt(unsigned char nr);
 
+    virtual void requestReadCharBlock(unsigned char nr, unsigned char count);
+
+    virtual void requestReadIntBlock(unsigned char nr, unsigned char count);
+
     virtual char getLastReadChar(unsigned char nr);
 
     virtual short int getLastReadInt(unsigned char nr);
 
     virtual void execute();
 
+    virtual void queueExecute();
+
+    virtual void executeQueue();
+
+    // Bus time of the last transaction with the given node. For batched transactions it is
+    // the time from the previous response, or from sending, until the node's response was received
+    virtual double getLastTransactionTime(unsigned char nr);
+
+    // Only used with batched transactions, the broadcast frames are sent
+    // ahead of the queued frames in executeQueue()
+    virtual bool writeBroadcastReference(short int position, short int velocity, short int feedforward);
+
+    virtual void setTransactionDeadline(std::chrono::steady_clock::time_point deadline);
+
+    virtual CommunicationStatus getCommunicationStatus(unsigned char nr);
+
+    virtual std::string getName() const;
+
+    // When enabled, a failed response does not throw. Received data is discarded until the line
+    // is quiet, then the reads of the failed frame and of the frames queued after it are repeated,
+    // each failed frame at most once and only if there is time left before the transaction deadline.
+    // The repeated frames carry no writes and the nodes do not apply them, which requires breaking
+    // change number 5 or higher, and the broadcast frames are not sent again. The frame of a node
+    // that also failed its previous transaction is not repeated. A node whose transaction still
+    // fails is marked in getCommunicationStatus() and the error is only thrown when it has failed
+    // maxConsecutiveFailures transactions in a row.
+    void enableErrorRecovery(bool enable = true, size_t maxConsecutiveFailures = 10);
+
+    // When enabled, queueExecute() only appends the frame to the send buffer and
+    // executeQueue() sends all queued frames in one write before reading the responses
+    // in the same order. This requires that the nodes answer one at a time, which is
+    // the case for nodes handled by the same controller. Nodes on separate controllers
+    // sharing one return line would answer simultaneously.
+    void enableBatchedTransactions(bool enable = true);
+
+    // When enabled, a node's response timeout is the p99.9 of how much later than their transfer
+    // time at the baud rate its responses complete, plus margin seconds, instead of the fixed
+    // maxResponseTimeout. Nodes with fewer than minResponseTimeSamples responses use the
+    // statistics of the whole bus. The transaction deadline limits the time waited beyond the
+    // transfer time of a response further. Meant to be used with error recovery, so that a
+    // silent node only costs a few milliseconds per cycle.
+    //
+    // A timed out response is recorded at the time waited, so the timeout of a node that has
+    // become slower than its statistics grows with each failure until its responses are received.
+    // It grows up to maxSlowNodeTimeoutFactor times the timeout of the bus, a node that is slower
+    // than that is treated as silent.
+    void enableAdaptiveTimeouts(bool enable = true, double margin = 0.002);
+
+    // Current response timeout of the node in seconds, counted from the expected end of the response
+    double getResponseTimeout(unsigned char nr) const;
+
+    class DiscoveredNode
+    {
+    public:
+        unsigned char nodeNr;
+        unsigned char breakingChangeNr;
+    };
+
+    // Returns the nodes in the given range that answer a probe within timeout seconds. The
+    // responses carry no node number, so each probe reads char register nodeNr % 16 and int
+    // register nodeNr / 16, whose echoed indexes identify the node. With batched transactions
+    // all probes are sent in one write and overlap, otherwise they are sent one at a time.
+    // Like any frame without a reference, a probe disables the control of the servo. Node
+    // numbers from repeatedFrameNodeNrOffset are not scanned. The scan uses the bus on its own
+    // and must not run while a ServoManager is driving the same bus.
+    virtual std::vector<DiscoveredNode> discoverNodes(unsigned char firstNodeNr = 1,
+            unsigned char lastNodeNr = 63, double timeout = 0.005);
+
 protected:
+    // Histogram of response times with logarithmic buckets of about 9 % relative width. The
+    // counts are halved every decayInterval samples, so the quantiles follow changes on the bus.
+    class ResponseTimeHistogram
+    {
+    public:
+        void record(double seconds);
+
+        // Upper end of the bucket holding the quantile
+        double getQuantile(double quantile) const;
+
+        uint32_t getCount() const;
+
+    private:
+        static constexpr double firstBucketEnd = 50e-6;
+        static constexpr size_t bucketsPerOctave = 8;
+        static constexpr size_t bucketCount = 12 * bucketsPerOctave + 1;
+        static constexpr uint32_t decayInterval = 4096;
+
+        std::array<uint32_t, bucketCount> buckets{};
+        uint32_t count{0};
+    };
+
+    class NodeBuffer
+    {
+    public:
+        std::array<char, 16> charArray{0};
+        std::array<short int, 16> intArray{0};
+        double transactionTime{0.0};
+        std::array<short int, 3> broadcastReference{0};
+        bool broadcastReferencePending{false};
+        CommunicationStatus status;
+        ResponseTimeHistogram responseTimes;
+    };
+
+    class QueuedTransaction
+    {
+    public:
+        unsigned char nodeNr;
+        size_t receiveSize;
+        size_t frameBegin;
+        size_t responseSize;
+        bool retried;
+        bool failed;
+
+        // Bytes of the last write up to and including the frame
+        size_t writeEnd;
+    };
+
+    // A frame holds at most 255 command bytes since the length is sent as one byte
+    static constexpr size_t maxFrameCommandSize = 255;
+
+    // Read indexes of the block read commands, followed by the parameter byte (nr << 4) | (count - 1).
+    // The response is the echoed index followed by the values.
+    static constexpr unsigned char charBlockReadIndex = 32;
+    static constexpr unsigned char intBlockReadIndex = 64 + 32;
+    static constexpr size_t maxQueuedTransactions = 32;
+
+    // Frames to this node number carry int 0 to 2 for consecutive nodes,
+    // the first node number followed by six bytes per node
+    static constexpr unsigned char broadcastNodeNr = 0;
+
+    // Frames to this offset plus the node number repeat the reads of a frame, without being applied
+    static constexpr unsigned char repeatedFrameNodeNrOffset = 128;
+    static constexpr unsigned char repeatedFrameBreakingChangeNr = 5;
+
+    // Silence on the line after which the responses to a failed batch are considered drained
+    static constexpr std::chrono::microseconds resyncQuietTime{2000};
+
+    static constexpr unsigned int baudRate = 115200;
+
+    static constexpr std::chrono::milliseconds maxResponseTimeout{50};
+    static constexpr uint32_t minResponseTimeSamples = 32;
+    static constexpr double maxSlowNodeTimeoutFactor = 2.0;
+
+    void addToQueue();
+
+    void clearQueue();
+
+    void appendFrameToSendBuffer();
+
+    void buildBroadcastFrames();
+
+    // Writes the broadcast frames and the queued frames
+    void writeSendBuffer();
+
+    // Writes frames repeating the reads of the transactions from transactionIndex that have not failed
+    void writeRepeatedFrames(size_t transactionIndex, const unsigned char* receiveBegin);
+
+    bool canRepeatFrame(const QueuedTransaction& transaction) const;
+
+    // Number of bytes of the response to the frame in receiveArray, including the final 0xff
+    size_t getResponseSize() const;
+
+    // Time when the response of the transaction would be received if the node answered without
+    // delay, given that the previous response was received at previousResponseTime
+    std::chrono::steady_clock::time_point getExpectedResponseTime(size_t transactionIndex,
+            std::chrono::steady_clock::time_point previousResponseTime) const;
+
+    // Returns nullptr if neither the node nor the bus has enough samples
+    const ResponseTimeHistogram* getResponseTimeHistogram(unsigned char nr) const;
+
+    // Sets the reader deadline for the first byte of the transaction's response and
+    // returns the deadline for the whole response
+    std::chrono::steady_clock::time_point startResponseTimeout(size_t transactionIndex,
+            std::chrono::steady_clock::time_point expectedTime);
+
+    bool resendFitsBeforeDeadline(size_t transactionIndex) const;
+
+    // Returns true if the node has reached the maximum number of consecutive failures
+    bool registerFailedTransaction(unsigned char nr);
+
+    void receiveResponse(unsigned char nodeNr,
+            const unsigned char* receiveBegin,
+            const unsigned char* receiveEnd,
+            std::chrono::steady_clock::time_point responseDeadline);
+
     class blocking_reader
     {
         boost::asio::serial_port& port;
         size_t timeout;
-        char c;
-        boost::asio::deadline_timer timer;
-        bool read_error;
+        std::chrono::steady_clock::time_point deadline;
 
-           // Called when an async read completes or has been cancelled
-        void read_complete(const boost::system::error_code& error,
-                            size_t bytes_transferred);
+        std::array<char, 1024> receiveBuffer;
+        size_t receiveBufferReadIndex{0};
+        size_t receiveBufferEndIndex{0};
 
-           // Called when the timer's deadline expires.
-        void time_out(const boost::system::error_code& error);
+           // Waits until data is available or the deadline is reached and
+        // reads all available data into the receive buffer
+        bool fill_receive_buffer();
 
        public:
 
-           // Constructs a blocking reader, pass in an open serial_port and
+           // Constructs a blocking reader, pass in a serial_port and
         // a timeout in milliseconds.
         blocking_reader(boost::asio::serial_port& port, size_t timeout);
 
+           // Discards all received data that has not been read
+        void flush();
+
+           // Starts the timeout for the next response, all following
+        // reads share the same deadline
+        void start_timeout();
+
+        void set_deadline(std::chrono::steady_clock::time_point newDeadline);
+
+           // Discards received data until nothing has been received for quietTime
+        void discard_until_quiet(std::chrono::steady_clock::duration quietTime);
+
            // Reads a character or times out
         // returns false if the read times out
         bool read_char(char& val);
     };
 
-    std::vector<unsigned char> commandArray;
-    std::vector<unsigned char> receiveArray;
+    FixedCapacityVector<unsigned char, maxFrameCommandSize> commandArray;
+    FixedCapacityVector<unsigned char, maxFrameCommandSize> receiveArray;
+
+    FixedCapacityVector<unsigned char, maxQueuedTransactions * (3 + maxFrameCommandSize)> sendBuffer;
+    FixedCapacityVector<unsigned char, maxQueuedTransactions * (3 + maxFrameCommandSize)> repeatBuffer;
 
-    std::vector<unsigned char> sendBuffer;
+    FixedCapacityVector<unsigned char, 256 * (4 + 6)> broadcastBuffer;
+    bool broadcastReferencesPending{false};
+
+    bool batchedTransactionsEnabled{false};
+    bool errorRecoveryEnabled{false};
+    size_t maxConsecutiveFailures{10};
+    bool adaptiveTimeoutsEnabled{false};
+    double responseTimeoutMargin{0.002};
+    ResponseTimeHistogram busResponseTimes;
+    std::chrono::steady_clock::time_point lastWriteTime;
+    std::chrono::steady_clock::time_point transactionDeadline{std::chrono::steady_clock::time_point::max()};
+    FixedCapacityVector<QueuedTransaction, maxQueuedTransactions> queuedTransactions;
+    FixedCapacityVector<unsigned char, maxQueuedTransactions * maxFrameCommandSize> queuedReceiveArray;
 
     unsigned char nodeNr;
-    std::array<char, 16> charArray{0};
-    std::array<short int, 16> intArray{0};
+    std::array<NodeBuffer, 256> nodeBuffers;
+
+    std::string devName;
 
     boost::asio::io_service io;
     boost::asio::serial_port port;
@@ -131,28 +735,111 @@ protected:
 class SimulateCommunication : public SerialCommunication
 {
 public:
-    SimulateCommunication()
-    {
-    }
+    SimulateCommunication();
+
+    // The servos are simulated up to the current time of clock, a VirtualClock lets the
+    // simulation run faster than real time
+    SimulateCommunication(std::shared_ptr<Clock> clock);
 
     virtual void execute() override;
 
+    virtual void queueExecute() override;
+
+    virtual bool writeBroadcastReference(short int position, short int velocity, short int feedforward) override;
+
+    virtual std::shared_ptr<Clock> getClock() const override;
+
+    // A simulated bus has no fixed set of nodes, the nodes simulated so far are returned
+    virtual std::vector<DiscoveredNode> discoverNodes(unsigned char firstNodeNr = 1,
+            unsigned char lastNodeNr = 63, double timeout = 0.005) override;
+
+    // Simulates servos running the plant model, Kalman filter and control law of the
+    // firmware's defaultSim configuration. The state is stored as structure of arrays in
+    // blocks of servos so that all servos can be stepped together with vectorized code.
     class ServoSim
     {
     public:
-        void run()
+        static constexpr double cycleTime = 0.0006;
+
+        size_t size() const;
+
+        void addServo();
+
+        // Steps all servos one control loop
+        void step();
+
+        // Updates the registers read by the host, as the firmware does every communication cycle
+        void updateRegisters(size_t i);
+
+        // Applies written registers, as the firmware does when a frame has been received
+        void applyRegisters(size_t i);
+
+        std::vector<std::array<char, 16> > charArray;
+        std::vector<std::array<short int, 16> > intArray;
+        std::vector<std::array<bool, 16> > charArrayChanged;
+        std::vector<std::array<bool, 16> > intArrayChanged;
+
+    private:
+        static constexpr size_t blockSize = 8;
+
+        // State of blockSize servos, one array per variable
+        class Block
         {
-            intArray.at(3) = intArray.at(0);
-            intArray.at(10) = intArray.at(0);
-            intArray.at(4) = intArray.at(1);
-            intArray.at(5) = intArray.at(2);
-        }
+        public:
+            using Array = std::array<float, blockSize>;
+
+            Array plantPos{0};
+            Array plantVel{0};
+
+            Array xhat0{0};
+            Array xhat1{0};
+            Array xhat2{0};
+            Array k0{0};
+            Array k1{0};
+            Array k2{0};
+
+            Array l0{0};
+            Array l1{0};
+            Array l2{0};
+            Array l3{0};
+
+            Array posRef{0};
+            Array velRef{0};
+            Array feedForward{0};
+            Array posDiff{0};
+            Array vControlRef{0};
+            Array ivel{0};
+            Array controlSignal{0};
+            Array pwm{0};
+
+            // Modes are stored as 0.0 or 1.0 to keep the step loop free from branches
+            Array controlEnabled{0};
+            Array openLoopMode{0};
+            Array pwmOpenLoopMode{0};
+            Array pendingIntegralCalc{0};
+        };
 
-        std::array<char, 16> charArray{0};
-        std::array<short int, 16> intArray{0};
+        void updateControlParameters(size_t i);
+
+        unsigned char loopNr{0};
+
+        std::vector<Block> blocks;
+
+        std::vector<unsigned char> controlSpeed;
+        std::vector<unsigned short int> velControlSpeed;
+        std::vector<unsigned short int> filterSpeed;
+        std::vector<float> inertiaMarg;
     };
 
-    std::vector<ServoSim> servoSims;
+    ServoSim servoSims;
+
+private:
+    // Steps the simulated servos up to the current time
+    void stepServoSims();
+
+    std::shared_ptr<Clock> clock;
+    std::chrono::steady_clock::time_point startTime;
+    uint64_t steppedLoops{0};
 };
 
 template <typename T, typename U>
@@ -185,6 +872,68 @@ class ContinuousValueUpCaster
     ValueType value{0};
 };
 
+#include <map>
+#include <mutex>
+#include <string>
+
+// Per node link metadata kept in a file between process starts, so that a restarted
+// process can skip the measurement of the control loop time in the init sequence. The
+// entries are keyed by bus name and node number and are only used if the breaking change
+// number read in the first init round matches and the loop numbers of the following init
+// rounds agree with the cached loop time. Otherwise the full init sequence runs and the
+// entry is replaced.
+class LinkCalibrationCache
+{
+public:
+    class Entry
+    {
+    public:
+        unsigned char breakingChangeNr{0};
+        double loopCycleTime{0.0};
+    };
+
+    // A missing file is created on the first set()
+    LinkCalibrationCache(const std::string& fileName);
+
+    bool get(const std::string& busName, unsigned char nodeNr, Entry& entry) const;
+
+    // Does not throw if the file can not be written, since it is called from the init
+    // sequence. The entry is then only kept by this object and getSaveError() tells why.
+    void set(const std::string& busName, unsigned char nodeNr, const Entry& entry);
+
+    // Empty if the last write of the file succeeded
+    std::string getSaveError() const;
+
+private:
+    void save();
+
+    std::string fileName;
+    mutable std::mutex mutex;
+    std::map<std::pair<std::string, unsigned char>, Entry> entries;
+    std::string saveError;
+};
+
+class ServoState
+{
+public:
+    double position{0.0};
+    double velocity{0.0};
+    double current{0.0};
+    double controlError{0.0};
+    short int loopTime{0};
+    double remoteTime{0.0};
+
+    // False if the last response was lost, the values are then from an earlier cycle
+    bool communicationOk{false};
+
+    // The position reference as given to setReference(), referenceSent is true if it
+    // was sent in the last cycle
+    double referencePosition{0.0};
+    double referenceVelocity{0.0};
+    double referenceFeedForward{0.0};
+    bool referenceSent{false};
+};
+
 class DCServoCommunicator
 {
 public:
@@ -197,12 +946,34 @@ public:
         unsigned short int minCost{0};
     };
 
+    enum class ReadValue
+    {
+        position,
+        encoderPosition,
+        velocity,
+        controlSignal,
+        current,
+        pwmControlSignal,
+        cpuLoad,
+        loopTime,
+        time,
+        backlashCompensation,
+        opticalEncoderChannelData,
+        lowLevelControlError,
+        nrOfReadValues
+    };
+
     DCServoCommunicator(unsigned char nodeNr, Communication* bus);
 
     DCServoCommunicator(const DCServoCommunicator&) = delete;
 
     void setOffsetAndScaling(double scale, double offset, double startPosition = 0);
 
+    // Must be set before the init sequence. With a valid cache entry the init sequence
+    // completes as soon as its samples span enough control loops to check the cached loop
+    // time, otherwise the entry is updated when the full init is complete.
+    void setLinkCalibrationCache(std::shared_ptr<LinkCalibrationCache> cache);
+
     void setControlSpeed(unsigned char controlSpeed, double inertiaMarg = 1.0);
     void setControlSpeed(unsigned char controlSpeed, unsigned short int velControlSpeed,
             unsigned short int filterSpeed, double inertiaMarg = 1.0);
@@ -216,10 +987,39 @@ public:
 
     bool isInitComplete() const;
 
+    // False if the response of the last run was lost
     bool isCommunicationOk() const;
 
+    CommunicationStatus getCommunicationStatus() const;
+
+    // Reads the value every divisor:th cycle. Values with a divisor above one are spread
+    // over the cycles so that all frames get about the same size. A divisor of 0 removes
+    // the subscription, the value is then only read in the cycle after its getter was
+    // called. Slow rates for position and time must still be fast enough to track the
+    // wraparound of the 16 bit position and 8 bit loop number.
+    void setPollingDivisor(ReadValue value, unsigned int divisor);
+
+    unsigned int getPollingDivisor(ReadValue value) const;
+
+    // Latest received values, without requesting any reads
+    void getState(ServoState& state) const;
+
     void setReference(const float& pos, const float& vel, const float& feedforwardU);
 
+    // With timed references the servo applies each reference at the control loop that
+    // runs at the time given by setReferenceApplyTime(), instead of timing it from when
+    // the reference arrives. Requires firmware with breaking change 4 and a measured loop
+    // time. References for times that have passed, e.g. in a late cycle, are applied in the
+    // running loop. The servo only leaves the mode when it is disabled here, since an untimed
+    // reference drops the timed references it has queued.
+    void enableTimedReferences(bool enable = true);
+
+    bool isTimedReferencesEnabled() const;
+
+    // Local time, in seconds since the epoch of the bus clock, at which the next sent
+    // reference takes effect. Set by ServoManager to the end of each cycle.
+    void setReferenceApplyTime(double localTime);
+
     void setOpenLoopControlSignal(const float& feedforwardU, bool pwmMode);
 
     float getPosition(bool withBacklash = true) const;
@@ -242,6 +1042,21 @@ public:
 
     double getTime() const;
 
+    // Local time, in seconds since the epoch of the bus clock, at which the servo's control
+    // loop reached the given time from getTime(). Tracks the offset and drift between the
+    // clocks, which requires that the time is read regularly.
+    double getLocalTimeOfRemoteTime(double remoteTime) const;
+
+    double getRemoteTimeOfLocalTime(double localTime) const;
+
+    // Relative rate error of the servo's control loop compared to the bus clock
+    double getClockDrift() const;
+
+    // Standard deviation of the time synchronization in seconds, infinity while the clocks
+    // are not synchronized, i.e. before the first loop number after the init sequence and
+    // while the tracking restarts after too many rejected samples
+    double getTimeSyncError() const;
+
     float getBacklashCompensation() const;
 
     OpticalEncoderChannelData getOpticalEncoderChannelData() const;
@@ -252,42 +1067,135 @@ public:
 
     double getOffset() const;
 
+    unsigned char getNodeNr() const;
+
+    Communication* getBus() const;
+
     void run();
 
+    void queueRun();
+
+    void completeRun();
+
+    const LatencyHistogram& getBusTimeHistogram() const;
+
+    const LatencyHistogram& getDecodeTimeHistogram() const;
+
 private:
     class ControlLoopSyncedTimeHandler
     {
     public:
-        ControlLoopSyncedTimeHandler();
+        ControlLoopSyncedTimeHandler(std::shared_ptr<Clock> clock);
 
         bool isInitialized() const;
 
+        // True when the next call to initialize() completes the initialization
+        bool hasAllInitSamples() const;
+
+        // Marks when the loop number of the next sample is requested
+        void startSample();
+
         bool initialize(unsigned char loopNr);
 
+        // Initializes from one sample and a known loop time
+        void initialize(unsigned char loopNr, double loopCycleTime);
+
+        // True when enough loops have passed since the samples given to initialize(loopNr) to
+        // check a known loop time
+        bool canCheckLoopCycleTime(double loopCycleTime) const;
+
+        // True if the loop numbers of the samples from the second one agree with the loop time
+        bool matchesLoopCycleTime(double loopCycleTime) const;
+
+        // -1 if the loop time could not be measured
+        double getLoopCycleTime() const;
+
         void update(unsigned char loopNr);
 
         double get() const;
 
         double getLocalTime() const;
 
+        // Conversions between remote time and local time, in seconds since the epoch of
+        // the bus clock, using the tracked offset and drift
+        double toLocalTime(double remoteTime) const;
+
+        double toRemoteTime(double localTime) const;
+
+        // Relative rate error of the servo's control loop compared to the local clock
+        double getDrift() const;
+
+        // Standard deviation of the estimated local time of the last sampled control loop,
+        // infinity while the filter is not tracking
+        double getSyncError() const;
+
+        // Lowest 8 bits of the number of the control loop running at the given local time,
+        // false if the loop time is not known. Times that have passed give the running loop
+        // and times more than 100 loops ahead give the loop 100 loops ahead.
+        bool getLoopNr(double localTime, unsigned char& loopNr) const;
+
     private:
         class InitData
         {
         public:
             double localTime;
+            double requestLocalTime;
             unsigned char loopNr;
         };
 
+        void addInitSample(double localTime, unsigned char loopNr);
+
+        void updateFilter(long int nrOfLoops, double localTime);
+
         constexpr static double us200 = 200.0 / 1000000;
+        constexpr static size_t nrOfInitSamples = 20;
+        constexpr static double minCheckedLoops = 20.0;
 
-        mutable std::chrono::high_resolution_clock::time_point initTimePoint;
+        std::shared_ptr<Clock> clock;
+        mutable std::chrono::steady_clock::time_point initTimePoint;
+        std::chrono::steady_clock::time_point sampleRequestTimePoint;
         std::vector<InitData> initDataList;
         double loopCycleTime{0.0};
         double lastRemoteTime{0.0};
+
+        // Kalman filter tracking the local time of the last sampled control loop and the
+        // local duration of one control loop. Responses arriving much later than expected,
+        // e.g. after retries, are not used for the estimate.
+        bool filterInitialized{false};
+        double loopLocalTime{0.0};
+        double localLoopCycleTime{0.0};
+        double covariance00{0.0};
+        double covariance01{0.0};
+        double covariance11{0.0};
+        double measurementVariance{0.0};
+        unsigned int rejectedSamples{0};
+    };
+
+    class ReadSchedule
+    {
+    public:
+        unsigned int divisor{0};
+        unsigned int phase{0};
     };
 
     void updateOffset();
 
+    void prepareRun();
+
+    void updateReadSchedule();
+
+    void requestReads(const std::array<bool, 16>& requested, bool intRegisters);
+
+    bool isScheduledRead(const ReadSchedule& schedule) const;
+
+    void requestIntRead(size_t i) const;
+
+    void requestCharRead(size_t i) const;
+
+    float calculatePosition(bool withBacklash) const;
+
+    float calculateControlError(bool withBacklash) const;
+
     Communication* bus{nullptr};
     unsigned char nodeNr{0};
 
@@ -295,6 +1203,10 @@ private:
 
     int initState{0};
     ControlLoopSyncedTimeHandler remoteTimeHandler;
+    std::shared_ptr<LinkCalibrationCache> linkCalibrationCache;
+    bool linkCalibrationCached{false};
+    bool linkCalibrationValidated{false};
+    LinkCalibrationCache::Entry cachedLinkCalibration;
     bool backlashControlDisabled{false};
     bool newPositionReference{false};
     bool newOpenLoopControlSignal{false};
@@ -309,10 +1221,18 @@ private:
     unsigned char backlashSize{0};
 
     mutable std::array<bool, 16> activeIntReads{false};
+    std::array<bool, 16> requestedIntReads{false};
     std::array<short int, 16> intReadBuffer{0};
 
     mutable std::array<bool, 16> activeCharReads{false};
+    std::array<bool, 16> requestedCharReads{false};
     std::array<char, 16> charReadBuffer{0};
+    bool loopNrReadActive{false};
+
+    std::array<unsigned int, static_cast<size_t>(ReadValue::nrOfReadValues)> pollingDivisors{0};
+    std::array<ReadSchedule, 16> intReadSchedules;
+    std::array<ReadSchedule, 16> charReadSchedules;
+    unsigned long int readScheduleCycleNr{0};
 
     ContinuousValueUpCaster<long int, short int> intReadBufferIndex3Upscaling;
     ContinuousValueUpCaster<long int, short int> intReadBufferIndex10Upscaling;
@@ -331,6 +1251,10 @@ private:
 
     float lowLevelControlError{0.0};
 
+    std::array<float, 3> userReference{0};
+    bool referenceSent{false};
+    bool timedReferences{false};
+    double referenceApplyTime{0.0};
     long int refPos{0};
     std::array<long int, 5> activeRefPos{0};
     short int refVel{0};
@@ -350,18 +1274,229 @@ private:
     // ----------------------------------------
     // 0 : version <= 4.0
     // 1 : version >= 4.1 : breaking change is velocityUpscaling = 8 > 1
+    // 2 : version >= 4.2 : block read commands for consecutive registers
+    // 3 : version >= 4.2 : broadcast reference frames to node number 0
+    // 4 : version >= 4.2 : char register 13 sets the loop number where int 0 to 2 take effect
+    // 5 : version >= 4.2 : frames to node number 128 + n repeat a frame to node n without applying it
     unsigned char breakingChangeNr{0};
+
+    LatencyHistogram busTimeHistogram;
+    LatencyHistogram decodeTimeHistogram;
 };
 
 #include <chrono>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
 #include <algorithm>
 #include <functional>
+#include <future>
+
+class RealTimeConfig
+{
+public:
+    // SCHED_FIFO priority of the manager and bus threads
+    int priority{80};
+
+    // CPU to pin the manager thread to, -1 for no affinity
+    int managerCpu{-1};
+
+    // CPUs to pin the bus threads to, in bus order starting from the second bus
+    std::vector<int> busThreadCpus;
+
+    bool lockMemory{true};
+
+    // Time in seconds before each deadline to stop sleeping and busy wait instead
+    double busySpinTime{0.0};
+};
+
+class CycleTimingSnapshot
+{
+public:
+    LatencyStatistics wakeupLateness;
+    LatencyStatistics sendHandlerTime;
+    LatencyStatistics readHandlerTime;
+    LatencyStatistics cycleTime;
+
+    // In the same order as ServoManager::servos
+    std::vector<LatencyStatistics> nodeBusTime;
+    std::vector<LatencyStatistics> nodeDecodeTime;
+};
+
+class TimedReference
+{
+public:
+    // Manager time in seconds, see ServoManager::getTime()
+    double time{0.0};
+    double position{0.0};
+    double velocity{0.0};
+    double feedForward{0.0};
+};
+
+// References of one servo that the application queues ahead of time. Each cycle the
+// manager interpolates between the references around the cycle's time and sets it on
+// the servo before the send command handler is called.
+class ReferenceQueue
+{
+public:
+    ReferenceQueue(size_t capacity = 1024);
+
+    // Called from one application thread, the references must be in time order. Returns
+    // the number of queued references, fewer than given if the queue is full.
+    size_t push(Span<const TimedReference> references);
+
+    bool push(const TimedReference& reference);
+
+    size_t size() const;
+
+    size_t capacity() const;
+
+    // Number of times the queue ran dry before the cycle time was reached. The last
+    // queued reference is then set once more with zero velocity and no further references
+    // are set until new ones are queued, so a trajectory that is not followed by more
+    // references ends with one underrun.
+    size_t getUnderrunCount() const;
+
+    // Number of references queued after a cycle had already passed their time, e.g. when a
+    // trajectory is queued too late after an underrun. The trajectory continues from the
+    // cycle time, the late references are only used to interpolate up to the next one.
+    size_t getLateReferenceCount() const;
+
+    // Called by the manager, returns false if there is no reference for time
+    bool getReference(double time, TimedReference& reference);
+
+private:
+    SpscQueue<TimedReference> queue;
+    TimedReference previous;
+    bool hasPrevious{false};
+    double lastTime{std::numeric_limits<double>::lowest()};
+    std::atomic<size_t> underrunCount{0};
+    std::atomic<size_t> lateReferenceCount{0};
+};
+
+class ServoStateSnapshot
+{
+public:
+    uint64_t cycleNr{0};
+
+    // In the same order as ServoManager::servos
+    std::vector<ServoState> servos;
+};
+
+// One servo's state in one cycle, the layout of the records in a telemetry file
+class TelemetryRecord
+{
+public:
+    uint64_t cycleNr{0};
+    double time{0.0};
+    double position{0.0};
+    double velocity{0.0};
+    double current{0.0};
+    double controlError{0.0};
+    double remoteTime{0.0};
+    double referencePosition{0.0};
+    double referenceVelocity{0.0};
+    double referenceFeedForward{0.0};
+    int16_t loopTime{0};
+    uint16_t servoIndex{0};
+    uint8_t communicationOk{0};
+    uint8_t referenceSent{0};
+    uint8_t reserved[10]{0};
+};
+
+static_assert(sizeof(TelemetryRecord) == 96, "The telemetry file layout depends on the record size");
+
+class TelemetryFileHeader
+{
+public:
+    static constexpr char magicValue[8] = "SPTELEM";
+    static constexpr uint32_t currentVersion = 2;
+
+    char magic[8];
+    uint32_t version;
+    uint32_t recordSize;
+    uint64_t capacity;
+
+    // Total number of written records, the file holds the last capacity of them
+    std::atomic<uint64_t> writeCount;
+
+    // Cycle time of the recorded manager, 0 if unknown
+    double cycleTime;
+
+    uint8_t reserved[24];
+};
+
+static_assert(sizeof(TelemetryFileHeader) == 64, "The telemetry file layout depends on the header size");
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "The write count is shared through the file");
+
+// Records the servo states of every cycle to a preallocated, memory mapped ring file.
+// record() only copies the states into a wait-free queue, so it can be called from
+// the manager thread, a writer thread moves the records to the file.
+class TelemetryRecorder
+{
+public:
+    // The file holds the last capacity records, one record per servo and cycle
+    TelemetryRecorder(const std::string& fileName, size_t capacity, size_t queueCapacity = 4096);
+
+    ~TelemetryRecorder();
+
+    void record(const ServoStateSnapshot& snapshot, double time);
+
+    // Stored in the file header, set by ServoManager::setTelemetryRecorder()
+    void setCycleTime(double cycleTime);
+
+    // Records that did not fit in the queue
+    size_t getDroppedCount() const;
+
+private:
+    void writerLoop();
+
+    SpscQueue<TelemetryRecord> queue;
+    int fd{-1};
+    size_t mappedSize{0};
+    TelemetryFileHeader* header{nullptr};
+    TelemetryRecord* records{nullptr};
+    std::atomic<size_t> droppedCount{0};
+    std::atomic<bool> shuttingDown{false};
+    std::thread t;
+};
+
+// Reads a telemetry file, also while it is being recorded. Records that are overwritten
+// during reading then show up with a later cycle number.
+class TelemetryReader
+{
+public:
+    TelemetryReader(const std::string& fileName);
+
+    ~TelemetryReader();
+
+    // Number of records in the file at construction
+    size_t size() const;
+
+    // Oldest record first
+    const TelemetryRecord& operator[](size_t i) const;
+
+    double getCycleTime() const;
+
+    void writeCsv(std::ostream& out) const;
+
+    // Writes the records as a structured NumPy .npy array
+    void writeNumpy(std::ostream& out) const;
+
+private:
+    int fd{-1};
+    size_t mappedSize{0};
+    const TelemetryFileHeader* header{nullptr};
+    const TelemetryRecord* records{nullptr};
+    uint64_t writeCount{0};
+};
 
 class ServoManager
 {
 public:
+    // Number of threads that can read the servo states at the same time without waiting
+    static constexpr size_t maxConcurrentStateReaders = 4;
+
     ServoManager(double cycleTime,
             std::function<std::vector<std::unique_ptr<DCServoCommunicator> >() > initFunction,
             bool startManager = true);
@@ -370,8 +1505,19 @@ public:
 
     void run();
 
+    // The state getters return the state of the last complete cycle and can be called from any
+    // number of threads. They do not wait for the manager thread, and only wait for other readers
+    // when more than maxConcurrentStateReaders threads read at the same time. Called from the
+    // handler functions they read the manager thread's own copy.
     std::vector<double> getPosition() const;
 
+    void getPosition(Span<double> position) const;
+
+    // Does not allocate if snapshot already holds one entry per servo. Values are only
+    // updated in the cycles where they are read, see DCServoCommunicator::setPollingDivisor().
+    // The position is read every cycle unless a slower rate is set.
+    void getServoStates(ServoStateSnapshot& snapshot) const;
+
     void setHandlerFunctions(std::function<void(double, ServoManager&)> newSendCommandHandlerFunction, 
             std::function<void(double, ServoManager&)> newReadResultHandlerFunction,
             std::function<void(std::exception_ptr e)> newErrorHandlerFunction = std::function<void(std::exception_ptr e)>());
@@ -384,32 +1530,184 @@ public:
 
     void enableDelayedExceptions(bool enable = true);
 
+    // Restarts the manager threads if they are running
+    void enableRealTimeMode(bool enable = true, const RealTimeConfig& config = RealTimeConfig());
+
     std::exception_ptr getUnhandledException();
 
     bool isAlive(bool raiseException = true);
 
     double getCycleSleepTime() const;
 
+    // Time between the cycle deadline and the actual wakeup of the last cycle
+    double getWakeupJitter() const;
+
+    double getMaxWakeupJitter() const;
+
+    // Can be called from any thread without blocking the manager thread
+    CycleTimingSnapshot getTimingSnapshot() const;
+
+    size_t getNumberOfBuses() const;
+
+    // Time spent communicating on the given bus during the last cycle. Buses are numbered
+    // in order of first appearance in servos and run in parallel, one thread per bus.
+    double getBusCycleTime(size_t busIndex) const;
+
+    // Time of the last started cycle in seconds, the cycle number times the cycle time.
+    // Can be called from any thread.
+    double getTime() const;
+
+    // Queue of timestamped references for the servo with the given index in servos
+    ReferenceQueue& getReferenceQueue(size_t servoIndex);
+
+    // Records the servo states of every cycle, nullptr to stop recording. Must not be
+    // called while the manager is running.
+    void setTelemetryRecorder(std::shared_ptr<TelemetryRecorder> recorder);
+
+    // The clock of the buses. With a VirtualClock the cycles are run back to back and the
+    // clock is advanced one cycle time per cycle.
+    std::shared_ptr<Clock> getClock() const;
+
     std::vector<std::unique_ptr<DCServoCommunicator> > servos;
 
 protected:
 
     void registerUnhandledException(std::exception_ptr e);
 
-    std::vector<double> currentPosition;
+    class BusThread
+    {
+    public:
+        Communication* bus;
+        std::vector<DCServoCommunicator*> servos;
+        double cycleTime{0.0};
+        std::exception_ptr exception;
+        std::thread t;
+    };
+
+    void initServos();
+
+    void initBus(BusThread& busThread);
+
+    void runServos();
+
+    void runBus(BusThread& busThread);
+
+    void busThreadLoop(BusThread& busThread, size_t lastCycleNr);
+
+    void startBusThreads(std::function<void(std::thread&)> threadInitFunction);
+
+    void stopBusThreads();
+
+    void sleepUntil(std::chrono::steady_clock::time_point deadline);
+
+    void updateServoStates();
+
+    void applyQueuedReferences();
+
+    // Calls readFunction with the states of the last complete cycle
+    template <typename Function>
+    void readServoStates(Function readFunction) const;
+
+    ServoStateSnapshot currentServoStates;
+    MultiReaderTripleBuffer<ServoStateSnapshot, maxConcurrentStateReaders> servoStateBuffer;
+    std::vector<BusThread> busThreads;
 
     double cycleTime;
-    double cycleSleepTime{0.0};
+    std::shared_ptr<Clock> clock;
+    std::atomic<double> time{0.0};
+    std::vector<std::unique_ptr<ReferenceQueue> > referenceQueues;
+    std::shared_ptr<TelemetryRecorder> telemetryRecorder;
+    std::atomic<double> cycleSleepTime{0.0};
+    std::atomic<double> wakeupJitter{0.0};
+    std::atomic<double> maxWakeupJitter{0.0};
+    LatencyHistogram wakeupLatenessHistogram;
+    LatencyHistogram sendHandlerTimeHistogram;
+    LatencyHistogram readHandlerTimeHistogram;
+    LatencyHistogram cycleTimeHistogram;
+    bool realTimeModeEnabled{false};
+    RealTimeConfig realTimeConfig;
     bool shuttingDown{true};
     bool waitForThreadInit{true};
     bool delayedExceptionsEnabled{false};
     std::exception_ptr exception;
 
     std::thread t;
+    // Thread that executes run(), the state getters and shutdown() compare it with the calling thread
+    std::atomic<std::thread::id> managerThreadId{};
+    // Handler functions are published as an immutable bundle that the manager
+    // thread reads without locking. Replaced bundles are deleted when they are
+    // no longer marked as in use by the manager thread.
+    class HandlerFunctions
+    {
+    public:
+        std::function<void(double, ServoManager&)> sendCommandHandlerFunction;
+        std::function<void(double, ServoManager&)> readResultHandlerFunction;
+        std::function<void(std::exception_ptr)> errorHandlerFunction;
+    };
+
+    const HandlerFunctions* acquireHandlerFunctions();
+
+    void releaseHandlerFunctions();
+
     std::mutex handlerFunctionMutex;
-    std::function<void(double, ServoManager&)> sendCommandHandlerFunction;
-    std::function<void(double, ServoManager&)> readResultHandlerFunction;
-    std::function<void(std::exception_ptr)> errorHandlerFunction;
+    std::atomic<HandlerFunctions*> handlerFunctions{nullptr};
+    std::atomic<const HandlerFunctions*> handlerFunctionsInUse{nullptr};
+    std::vector<std::unique_ptr<HandlerFunctions> > retiredHandlerFunctions;
+
+    std::mutex busCycleMutex;
+    std::condition_variable busCycleStart;
+    std::condition_variable busCycleDone;
+    size_t busCycleNr{0};
+    size_t busThreadsRunning{0};
+    bool busThreadsShuttingDown{false};
+
+    // Start of the next cycle, failed transactions are only retried before it
+    std::chrono::steady_clock::time_point transactionDeadline{std::chrono::steady_clock::time_point::max()};
+};
+
+class TelemetryReplayReport
+{
+public:
+    class ServoDiff
+    {
+    public:
+        size_t comparedCycles{0};
+        double maxPositionDiff{0.0};
+        double rmsPositionDiff{0.0};
+        double maxVelocityDiff{0.0};
+        double maxControlErrorDiff{0.0};
+    };
+
+    size_t replayedCycles{0};
+
+    // Wall time of the replay in seconds
+    double replayTime{0.0};
+
+    // In the same order as the servos of the replay
+    std::vector<ServoDiff> servos;
+};
+
+// Replays the references of a recorded session through a ServoManager with simulated
+// servos on a virtual clock, as fast as the CPU allows, and compares the resulting
+// servo states with the recorded ones cycle by cycle. The simulated servos start at rest,
+// so only recordings from the start of a session can be reproduced exactly.
+class TelemetryReplay
+{
+public:
+    // servoFactory creates the servos of the recorded session on the given simulated bus,
+    // in the order of the recorded servo indexes
+    TelemetryReplay(const TelemetryReader& recording,
+            std::function<std::vector<std::unique_ptr<DCServoCommunicator> >(Communication*)> servoFactory);
+
+    // Records the replayed session
+    void setTelemetryRecorder(std::shared_ptr<TelemetryRecorder> recorder);
+
+    TelemetryReplayReport run();
+
+private:
+    const TelemetryReader& recording;
+    std::function<std::vector<std::unique_ptr<DCServoCommunicator> >(Communication*)> servoFactory;
+    std::shared_ptr<TelemetryRecorder> telemetryRecorder;
 };
 
 #endif
@@ -1,5 +1,21 @@
 #include "ServoProject.h"
 
+#include <poll.h>
+#include <termios.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <cerrno>
+#include <cstring>
+#include <numeric>
+#include <limits>
+#include <iomanip>
+#include <fstream>
+
 CommunicationError::CommunicationError(unsigned char nodeNr, ErrorCode code) :
         nodeNr(nodeNr), code(code)
 {
@@ -43,17 +59,151 @@ const char* CommunicationError::what() const throw()
     }
 }
 
+void LatencyHistogram::record(double seconds)
+{
+    uint64_t nanoseconds = seconds > 0.0 ? static_cast<uint64_t>(seconds * 1e9) : 0;
+
+    buckets[getBucketIndex(nanoseconds)].fetch_add(1, std::memory_order_relaxed);
+    sum.fetch_add(nanoseconds, std::memory_order_relaxed);
+    if (nanoseconds > max.load(std::memory_order_relaxed))
+    {
+        max.store(nanoseconds, std::memory_order_relaxed);
+    }
+    count.fetch_add(1, std::memory_order_release);
+}
+
+LatencyStatistics LatencyHistogram::getStatistics() const
+{
+    LatencyStatistics statistics;
+
+    std::array<uint64_t, bucketCount> bucketsCopy;
+    uint64_t totalCount = 0;
+    for (size_t i = 0; i != bucketCount; ++i)
+    {
+        bucketsCopy[i] = buckets[i].load(std::memory_order_relaxed);
+        totalCount += bucketsCopy[i];
+    }
+
+    if (totalCount == 0)
+    {
+        return statistics;
+    }
+
+    statistics.count = totalCount;
+    statistics.mean = sum.load(std::memory_order_relaxed) * 1e-9 / totalCount;
+    statistics.max = max.load(std::memory_order_relaxed) * 1e-9;
+
+    std::array<std::pair<double, double*>, 3> percentiles{{
+            {0.5, &statistics.p50},
+            {0.99, &statistics.p99},
+            {0.999, &statistics.p999}}};
+
+    uint64_t accumulatedCount = 0;
+    size_t percentileIndex = 0;
+    for (size_t i = 0; i != bucketCount && percentileIndex != percentiles.size(); ++i)
+    {
+        accumulatedCount += bucketsCopy[i];
+        while (percentileIndex != percentiles.size() &&
+                accumulatedCount >= percentiles[percentileIndex].first * totalCount)
+        {
+            *percentiles[percentileIndex].second = std::min(getBucketValue(i) * 1e-9, statistics.max);
+            ++percentileIndex;
+        }
+    }
+
+    return statistics;
+}
+
+size_t LatencyHistogram::getBucketIndex(uint64_t nanoseconds)
+{
+    if (nanoseconds < subBucketCount)
+    {
+        return nanoseconds;
+    }
+
+    int shift = 63 - __builtin_clzll(nanoseconds) - (subBucketBits - 1);
+    return (shift + 1) * subBucketHalfCount + (nanoseconds >> shift) - subBucketHalfCount;
+}
+
+uint64_t LatencyHistogram::getBucketValue(size_t index)
+{
+    if (index < subBucketCount)
+    {
+        return index;
+    }
+
+    // Upper end of the bucket
+    int shift = index / subBucketHalfCount - 1;
+    uint64_t subBucket = index % subBucketHalfCount + subBucketHalfCount;
+    return ((subBucket + 1) << shift) - 1;
+}
+
+std::shared_ptr<Clock> SteadyClock::getInstance()
+{
+    static std::shared_ptr<Clock> instance{std::make_shared<SteadyClock>()};
+    return instance;
+}
+
+std::chrono::steady_clock::time_point SteadyClock::now() const
+{
+    return std::chrono::steady_clock::now();
+}
+
+void SteadyClock::sleepUntil(std::chrono::steady_clock::time_point timePoint)
+{
+    std::this_thread::sleep_until(timePoint);
+}
+
+bool SteadyClock::isVirtual() const
+{
+    return false;
+}
+
+std::chrono::steady_clock::time_point VirtualClock::now() const
+{
+    return std::chrono::steady_clock::time_point{std::chrono::steady_clock::duration{ticks.load()}};
+}
+
+void VirtualClock::sleepUntil(std::chrono::steady_clock::time_point timePoint)
+{
+    auto newTicks = timePoint.time_since_epoch().count();
+    auto oldTicks = ticks.load();
+    while (oldTicks < newTicks && !ticks.compare_exchange_weak(oldTicks, newTicks))
+    {
+    }
+}
+
+bool VirtualClock::isVirtual() const
+{
+    return true;
+}
+
+void VirtualClock::advance(std::chrono::steady_clock::duration duration)
+{
+    ticks += duration.count();
+}
+
+std::shared_ptr<Clock> Communication::getClock() const
+{
+    return SteadyClock::getInstance();
+}
+
+std::string Communication::getName() const
+{
+    return std::string();
+}
+
 SerialCommunication::SerialCommunication(std::string devName) :
-        io(), port(io), reader(port, 50)
+        devName{devName}, io(), port(io), reader(port, maxResponseTimeout.count())
 {
     nodeNr = 1;
 
     port.open(devName);
-    port.set_option(boost::asio::serial_port_base::baud_rate(115200));
+    port.set_option(boost::asio::serial_port_base::baud_rate(baudRate));
 }
 
 SerialCommunication::SerialCommunication() :
-        io(), port(io), reader(port, 50)
+        io(), port(io), reader(port, maxResponseTimeout.count())
 {
     nodeNr = 1;
 }
@@ -88,901 +238,3250 @@ void SerialCommunication::requestReadInt(unsigned char nr)
     receiveArray.push_back(nr + 64);
 }
 
+void SerialCommunication::requestReadCharBlock(unsigned char nr, unsigned char count)
+{
+    unsigned char parameter = (nr << 4) | (count - 1);
+    commandArray.push_back(charBlockReadIndex + 128);
+    commandArray.push_back(parameter);
+    receiveArray.push_back(charBlockReadIndex);
+    receiveArray.push_back(parameter);
+}
+
+void SerialCommunication::requestReadIntBlock(unsigned char nr, unsigned char count)
+{
+    unsigned char parameter = (nr << 4) | (count - 1);
+    commandArray.push_back(intBlockReadIndex + 128);
+    commandArray.push_back(parameter);
+    receiveArray.push_back(intBlockReadIndex);
+    receiveArray.push_back(parameter);
+}
+
 char SerialCommunication::getLastReadChar(unsigned char nr)
 {
-    return charArray.at(nr);
+    return nodeBuffers[nodeNr].charArray.at(nr);
 }
 
 short int SerialCommunication::getLastReadInt(unsigned char nr)
 {
-    return intArray.at(nr);
+    return nodeBuffers[nodeNr].intArray.at(nr);
 }
 
 void SerialCommunication::execute()
 {
-    unsigned char checksum = 0;
-    unsigned char messageLenght = 0;
-
-    checksum -= nodeNr;
+    executeQueue();
+    addToQueue();
+    executeQueue();
+}
 
-    for (auto it = commandArray.begin(); it != commandArray.end(); ++it)
+void SerialCommunication::queueExecute()
+{
+    if (!batchedTransactionsEnabled)
     {
-        if (*it >= 128)
-        {
-            checksum -= *it;
-            messageLenght += 1;
-        }
-        else if (*it >= 64)
-        {
-            checksum -= *it;
-            ++it;
-            checksum -= *it;
-            ++it;
-            checksum -= *it;
-            messageLenght += 3;
-        }
-        else
-        {
-            checksum -= *it;
-            ++it;
-            checksum -= *it;
-            messageLenght += 2;
-        }
+        execute();
+        return;
     }
 
-    checksum -= messageLenght;
+    if (queuedTransactions.full() ||
+            sendBuffer.size() + 3 + commandArray.size() > sendBuffer.capacity() ||
+            queuedReceiveArray.size() + receiveArray.size() > queuedReceiveArray.capacity())
+    {
+        executeQueue();
+    }
 
-    sendBuffer.clear();
-    sendBuffer.push_back(nodeNr);
-    sendBuffer.push_back(checksum);
-    sendBuffer.push_back(messageLenght);
-    sendBuffer.insert(sendBuffer.end(), commandArray.begin(), commandArray.end());
+    addToQueue();
+}
 
-    size_t bytesSent = ::write(port.lowest_layer().native_handle(), &sendBuffer[0], sendBuffer.size());
-    if (bytesSent != sendBuffer.size())
+void SerialCommunication::executeQueue()
+{
+    if (queuedTransactions.empty() && !broadcastReferencesPending)
     {
-        throw CommunicationError(nodeNr, CommunicationError::COULD_NOT_SEND);
+        return;
     }
 
-    commandArray.clear();
+    try
+    {
+        using namespace std::chrono;
+        steady_clock::time_point lastTime = steady_clock::now();
 
-    std::vector<unsigned char> receiveArrayCopy = receiveArray;
-    receiveArray.clear();
+        writeSendBuffer();
 
-    char c = 0;
-    bool error = false;
-    for (auto it = receiveArrayCopy.begin(); it != receiveArrayCopy.end(); ++it)
-    {
-        error = !reader.read_char(c);
-        if (error)
+        const unsigned char* receiveIt = queuedReceiveArray.cbegin();
+        size_t i = 0;
+        while (i != queuedTransactions.size())
         {
-            reader.read_char(c);
-            throw CommunicationError(nodeNr, CommunicationError::NO_RESPONSE);
-        }
+            auto& transaction = queuedTransactions[i];
+            auto& nodeBuffer = nodeBuffers[transaction.nodeNr];
+            const unsigned char* receiveEnd = receiveIt + transaction.receiveSize;
+            if (transaction.failed)
+            {
+                receiveIt = receiveEnd;
+                ++i;
+                continue;
+            }
 
-        if (*it == c)
-        {
-            if (*it >= 64)
+            steady_clock::time_point expectedTime = getExpectedResponseTime(i, lastTime);
+
+            try
             {
-                error = !reader.read_char(c);
-                if (error)
+                auto responseDeadline = startResponseTimeout(i, expectedTime);
+                receiveResponse(transaction.nodeNr, receiveIt, receiveEnd, responseDeadline);
+            }
+            catch (CommunicationError& e)
+            {
+                ++nodeBuffer.status.errorCount;
+
+                // A timed out response is recorded at the time waited, a lower bound of its delay
+                if (e.code != CommunicationError::UNEXPECTED_RESPONSE && e.code != CommunicationError::CHECKSUM_ERROR)
                 {
-                    reader.read_char(c);
-                    throw CommunicationError(nodeNr, CommunicationError::PARTIAL_RESPONSE_TYPE_1);
+                    nodeBuffer.responseTimes.record(
+                            std::max(duration<double>(steady_clock::now() - expectedTime).count(), 0.0));
                 }
-                short value = static_cast<unsigned char>(c);
-
-                error = !reader.read_char(c);
-                if (error)
+                if (!errorRecoveryEnabled)
                 {
-                    reader.read_char(c);
-                    throw CommunicationError(nodeNr, CommunicationError::PARTIAL_RESPONSE_TYPE_2);
+                    nodeBuffer.status.lastTransactionOk = false;
+                    throw;
                 }
-                value += static_cast<unsigned char>(c) * static_cast<unsigned short>(256);
-                intArray.at(*it - 64) = value;
-            }
-            else
-            {
-                error = !reader.read_char(c);
-                if (error)
+
+                // The responses to the following frames are lost as well
+                reader.discard_until_quiet(resyncQuietTime);
+
+                // The nodes have applied the frames already, only their reads are repeated. The failed
+                // frame is repeated once, the following frames until their responses are received.
+                // A node that failed its previous transaction as well is not waited for again.
+                bool repeat = resendFitsBeforeDeadline(i);
+                for (size_t j = i; j != queuedTransactions.size(); ++j)
                 {
-                    reader.read_char(c);
-                    throw CommunicationError(nodeNr, CommunicationError::PARTIAL_RESPONSE_TYPE_3);
+                    auto& t = queuedTransactions[j];
+                    if (t.failed)
+                    {
+                        continue;
+                    }
+
+                    if (repeat && canRepeatFrame(t) &&
+                            (j != i || (!t.retried && nodeBuffer.status.consecutiveFailures == 0)))
+                    {
+                        continue;
+                    }
+
+                    t.failed = true;
+                    if (registerFailedTransaction(t.nodeNr))
+                    {
+                        if (j == i)
+                        {
+                            throw;
+                        }
+                        throw CommunicationError(t.nodeNr, CommunicationError::NO_RESPONSE);
+                    }
                 }
-                charArray.at(*it) = c;
-            }
-        }
-        else
-        {
-            while (true)
-            {
-                error = !reader.read_char(c);
-                if (error)
+
+                if (!transaction.failed)
                 {
-                    reader.read_char(c);
-                    break;
+                    transaction.retried = true;
+                    ++nodeBuffer.status.retryCount;
                 }
+
+                writeRepeatedFrames(i, receiveIt);
+                lastTime = steady_clock::now();
+                continue;
             }
+            receiveIt = receiveEnd;
 
-            throw CommunicationError(nodeNr, CommunicationError::UNEXPECTED_RESPONSE);
+            nodeBuffer.status.lastTransactionOk = true;
+            nodeBuffer.status.consecutiveFailures = 0;
+
+            steady_clock::time_point time = steady_clock::now();
+            nodeBuffer.transactionTime = duration<double>(time - lastTime).count();
+            lastTime = time;
+
+            double responseDelay = std::max(duration<double>(time - expectedTime).count(), 0.0);
+            nodeBuffer.responseTimes.record(responseDelay);
+            busResponseTimes.record(responseDelay);
+            ++i;
         }
     }
-    error = !reader.read_char(c);
-    if (error)
-    {
-        reader.read_char(c);
-        throw CommunicationError(nodeNr, CommunicationError::PARTIAL_RESPONSE_TYPE_4);
-    }
-    if (static_cast<unsigned char>(c) != 0xff)
+    catch (...)
     {
-        throw CommunicationError(nodeNr, CommunicationError::CHECKSUM_ERROR);
+        clearQueue();
+        throw;
     }
-}
-
-void SerialCommunication::blocking_reader::read_complete(const boost::system::error_code& error,
-                    size_t bytes_transferred)
-{        
 
-    read_error = (error || bytes_transferred == 0);
-    
-    // Read has finished, so cancel the
-    // timer.
-    timer.cancel();
+    clearQueue();
 }
 
-void SerialCommunication::blocking_reader::time_out(const boost::system::error_code& error)
+double SerialCommunication::getLastTransactionTime(unsigned char nr)
 {
+    return nodeBuffers[nr].transactionTime;
+}
 
-    // Was the timeout was cancelled?
-    if (error)
+bool SerialCommunication::writeBroadcastReference(short int position, short int velocity, short int feedforward)
+{
+    if (!batchedTransactionsEnabled || nodeNr == broadcastNodeNr)
     {
-        // yes
-        return;
+        return false;
     }
 
-    // no, we have timed out, so kill
-    // the read operation
-    // The read callback will be called
-    // with an error
-    port.cancel();
+    auto& buffer = nodeBuffers[nodeNr];
+    buffer.broadcastReference = {{position, velocity, feedforward}};
+    buffer.broadcastReferencePending = true;
+    broadcastReferencesPending = true;
+
+    return true;
 }
 
-SerialCommunication::blocking_reader::blocking_reader(boost::asio::serial_port& port, size_t timeout) :
-                                            port(port), timeout(timeout),
-                                            timer(port.get_executor()),
-                                            read_error(true)
+void SerialCommunication::setTransactionDeadline(std::chrono::steady_clock::time_point deadline)
 {
-     
+    transactionDeadline = deadline;
 }
 
-bool SerialCommunication::blocking_reader::read_char(char& val)
+CommunicationStatus SerialCommunication::getCommunicationStatus(unsigned char nr)
 {
-    
-    val = c = '\0';
-
-    // After a timeout & cancel it seems we need
-    // to do a reset for subsequent reads to work.
-    
-    boost::asio::execution_context& e_context = port.get_executor().context();
-    boost::asio::io_context& context_instance = static_cast<boost::asio::io_context&>(e_context);
-    context_instance.reset();
-
-    // Asynchronously read 1 character.
-    boost::asio::async_read(port, boost::asio::buffer(&c, 1), 
-            boost::bind(&blocking_reader::read_complete, 
-                    this, 
-                    boost::asio::placeholders::error, 
-                    boost::asio::placeholders::bytes_transferred)); 
+    return nodeBuffers[nr].status;
+}
 
-    // Setup a deadline time to implement our timeout.
-    timer.expires_from_now(boost::posix_time::milliseconds(timeout));
-    timer.async_wait(boost::bind(&blocking_reader::time_out,
-                            this, boost::asio::placeholders::error));
+std::string SerialCommunication::getName() const
+{
+    return devName;
+}
 
-    // This will block until a character is read
-    // or until the it is cancelled.
-    context_instance.run();
+void SerialCommunication::enableErrorRecovery(bool enable, size_t maxConsecutiveFailures)
+{
+    errorRecoveryEnabled = enable;
+    this->maxConsecutiveFailures = maxConsecutiveFailures;
+}
 
-    if (!read_error)
-        val = c;
+void SerialCommunication::enableBatchedTransactions(bool enable)
+{
+    batchedTransactionsEnabled = enable;
+}
 
-    return !read_error;
+void SerialCommunication::enableAdaptiveTimeouts(bool enable, double margin)
+{
+    adaptiveTimeoutsEnabled = enable;
+    responseTimeoutMargin = margin;
 }
 
-void SimulateCommunication::execute()
+double SerialCommunication::getResponseTimeout(unsigned char nr) const
 {
-    while (servoSims.size() < nodeNr)
+    double maxTimeout = std::chrono::duration<double>(maxResponseTimeout).count();
+
+    const ResponseTimeHistogram* histogram = getResponseTimeHistogram(nr);
+    if (!adaptiveTimeoutsEnabled || histogram == nullptr)
     {
-        servoSims.push_back(ServoSim());
+        return maxTimeout;
     }
 
-    auto& servo = servoSims.at(nodeNr - 1);
-    servo.run();
-
-    for (auto it = commandArray.begin(); it != commandArray.end(); ++it)
+    double timeout = histogram->getQuantile(0.999) + responseTimeoutMargin;
+    if (histogram != &busResponseTimes && busResponseTimes.getCount() >= minResponseTimeSamples)
     {
-        if (*it >= 128)
-        {
-            //read request, do nothing in sim
-        }
-        else if (*it >= 64)
-        {
-            const unsigned char intNr = *it - 64;
-            ++it;
-            short value = static_cast<unsigned char>(*it);
-            ++it;
-            value += static_cast<unsigned char>(*it) * static_cast<unsigned short>(256);
-            servo.intArray.at(intNr) = value;
-        }
-        else
-        {
-            const unsigned char charNr = *it;
-            ++it;
-            servo.charArray.at(charNr) = static_cast<unsigned char>(*it);
-        }
+        timeout = std::min(timeout, maxSlowNodeTimeoutFactor * (busResponseTimes.getQuantile(0.999) + responseTimeoutMargin));
     }
+    return std::min(timeout, maxTimeout);
+}
 
-    commandArray.clear();
+std::vector<SerialCommunication::DiscoveredNode> SerialCommunication::discoverNodes(
+        unsigned char firstNodeNr, unsigned char lastNodeNr, double timeout)
+{
+    executeQueue();
 
-    std::vector<unsigned char> receiveArrayCopy = receiveArray;
-    receiveArray.clear();
+    using namespace std::chrono;
+    const auto timeoutDuration = duration_cast<steady_clock::duration>(duration<double>(timeout));
+    const unsigned char savedNodeNr = nodeNr;
+
+    std::vector<DiscoveredNode> nodes;
+    std::vector<unsigned char> response;
+
+    // Frames to higher node numbers repeat a frame to a lower one, which the node would answer
+    lastNodeNr = std::min(lastNodeNr, static_cast<unsigned char>(repeatedFrameNodeNrOffset - 1));
 
-    for (auto it = receiveArrayCopy.begin(); it != receiveArrayCopy.end(); ++it)
+    unsigned int nr = std::max(firstNodeNr, static_cast<unsigned char>(broadcastNodeNr + 1));
+    while (nr <= lastNodeNr)
     {
-        if (*it >= 64)
+        do
         {
-            short value = servo.intArray.at(*it - 64);
-            intArray.at(*it - 64) = value;
+            nodeNr = nr;
+            requestReadChar(nr % 16);
+            requestReadInt(nr / 16);
+            requestReadChar(15);
+            appendFrameToSendBuffer();
+            receiveArray.clear();
+            ++nr;
         }
-        else
+        while (batchedTransactionsEnabled && nr <= lastNodeNr);
+
+        writeSendBuffer();
+        steady_clock::time_point sendDoneTime = steady_clock::now() +
+                duration_cast<steady_clock::duration>(duration<double>(sendBuffer.size() * 10.0 / baudRate));
+        sendBuffer.clear();
+
+        // A response is the echoed register index and value of each read followed by the
+        // checksum byte. Bytes that do not start a valid response, e.g. from a corrupted
+        // one, are skipped.
+        response.clear();
+        char c;
+        reader.set_deadline(sendDoneTime + timeoutDuration);
+        while (reader.read_char(c))
         {
-            char value = servo.charArray.at(*it);
-            charArray.at(*it) = value;
+            response.push_back(c);
+            if (response.size() == 8)
+            {
+                unsigned int responseNr = response[0] + (response[2] - 64) * 16;
+                if (response[0] < 16 && response[2] >= 64 && response[2] < 80 &&
+                        response[5] == 15 && response[7] == 0xff &&
+                        responseNr >= firstNodeNr && responseNr <= lastNodeNr)
+                {
+                    nodes.push_back(DiscoveredNode{static_cast<unsigned char>(responseNr), response[6]});
+                    response.clear();
+                }
+                else
+                {
+                    response.erase(response.begin());
+                }
+            }
+            reader.set_deadline(std::max(steady_clock::now(), sendDoneTime) + timeoutDuration);
         }
     }
+
+    nodeNr = savedNodeNr;
+    return nodes;
 }
 
-DCServoCommunicator::DCServoCommunicator(unsigned char nodeNr, Communication* bus)
+void SerialCommunication::addToQueue()
 {
-    activeIntReads.fill(true);
-    activeCharReads.fill(true);
-    this->nodeNr = nodeNr;
-    this->bus = bus;
+    if (queuedTransactions.empty())
+    {
+        sendBuffer.clear();
+    }
 
-    communicationIsOk = false;
-    initState = 0;
-    backlashControlDisabled = false;
-    newPositionReference = false;
-    newOpenLoopControlSignal = false;
+    size_t frameBegin = sendBuffer.size();
+    appendFrameToSendBuffer();
 
-    setOffsetAndScaling(1.0, 0);
+    queuedTransactions.push_back(
+            QueuedTransaction{nodeNr, receiveArray.size(), frameBegin, getResponseSize(), false, false, 0});
+    queuedReceiveArray.append(receiveArray.begin(), receiveArray.end());
+    receiveArray.clear();
 }
 
-void DCServoCommunicator::setOffsetAndScaling(double scale, double offset, double startPosition)
+void SerialCommunication::clearQueue()
 {
-	this->scale = scale;
-	this->offset = offset;
-    this->startPosition = startPosition;
-
-    if (isInitComplete())
-    {
-        updateOffset();
-    }
+    queuedTransactions.clear();
+    queuedReceiveArray.clear();
+    sendBuffer.clear();
+    broadcastBuffer.clear();
 }
 
-void DCServoCommunicator::updateOffset()
+void SerialCommunication::appendFrameToSendBuffer()
 {
-    float pos = getPosition() / scale;
-    startPosition /= scale;
+    unsigned char checksum = 0;
+    unsigned char messageLenght = commandArray.size();
 
-    long int wrapSize = (1l << 24) / positionUpscaling;
+    checksum -= nodeNr;
 
-    if (pos - startPosition > wrapSize / 2)
+    for (auto it = commandArray.begin(); it != commandArray.end(); ++it)
     {
-        offset -= wrapSize * scale;
+        checksum -= *it;
+    }
+
+    checksum -= messageLenght;
+
+    sendBuffer.push_back(nodeNr);
+    sendBuffer.push_back(checksum);
+    sendBuffer.push_back(messageLenght);
+    sendBuffer.append(commandArray.begin(), commandArray.end());
+
+    commandArray.clear();
+}
+
+void SerialCommunication::buildBroadcastFrames()
+{
+    broadcastBuffer.clear();
+
+    size_t nr = 1;
+    while (nr < nodeBuffers.size())
+    {
+        if (!nodeBuffers[nr].broadcastReferencePending)
+        {
+            ++nr;
+            continue;
+        }
+
+        size_t frameStart = broadcastBuffer.size();
+        broadcastBuffer.push_back(broadcastNodeNr);
+        broadcastBuffer.push_back(0);
+        broadcastBuffer.push_back(0);
+        broadcastBuffer.push_back(nr);
+
+        while (nr < nodeBuffers.size() &&
+                nodeBuffers[nr].broadcastReferencePending &&
+                broadcastBuffer.size() - frameStart - 3 + 6 <= maxFrameCommandSize)
+        {
+            for (short int value : nodeBuffers[nr].broadcastReference)
+            {
+                broadcastBuffer.push_back(static_cast<unsigned char>(value));
+                broadcastBuffer.push_back(static_cast<unsigned short>(value) / 256);
+            }
+            nodeBuffers[nr].broadcastReferencePending = false;
+            ++nr;
+        }
+
+        broadcastBuffer[frameStart + 2] = broadcastBuffer.size() - frameStart - 3;
+
+        unsigned char checksum = 0;
+        for (size_t i = frameStart; i != broadcastBuffer.size(); ++i)
+        {
+            checksum -= broadcastBuffer[i];
+        }
+        broadcastBuffer[frameStart + 1] = checksum;
+    }
+
+    broadcastReferencesPending = false;
+}
+
+void SerialCommunication::writeSendBuffer()
+{
+    reader.flush();
+
+    lastWriteTime = std::chrono::steady_clock::now();
+
+    if (broadcastReferencesPending)
+    {
+        buildBroadcastFrames();
+    }
+
+    for (size_t i = 0; i != queuedTransactions.size(); ++i)
+    {
+        size_t frameEnd = i + 1 != queuedTransactions.size() ?
+                queuedTransactions[i + 1].frameBegin : sendBuffer.size();
+        queuedTransactions[i].writeEnd = broadcastBuffer.size() + frameEnd;
+    }
+
+    if (!broadcastBuffer.empty())
+    {
+        size_t bytesSent = ::write(port.lowest_layer().native_handle(), &broadcastBuffer[0], broadcastBuffer.size());
+        if (bytesSent != broadcastBuffer.size())
+        {
+            throw CommunicationError(broadcastNodeNr, CommunicationError::COULD_NOT_SEND);
+        }
+    }
+
+    if (sendBuffer.empty())
+    {
+        return;
+    }
+
+    size_t bytesSent = ::write(port.lowest_layer().native_handle(), &sendBuffer[0], sendBuffer.size());
+    if (bytesSent != sendBuffer.size())
+    {
+        throw CommunicationError(nodeNr, CommunicationError::COULD_NOT_SEND);
+    }
+}
+
+void SerialCommunication::writeRepeatedFrames(size_t transactionIndex, const unsigned char* receiveBegin)
+{
+    reader.flush();
+
+    lastWriteTime = std::chrono::steady_clock::now();
+
+    // The receive array holds the register index of each read, the read command is the index
+    // plus 128, and the parameter byte of a block read is the same in both
+    repeatBuffer.clear();
+    const unsigned char* receiveIt = receiveBegin;
+    for (size_t i = transactionIndex; i != queuedTransactions.size(); ++i)
+    {
+        auto& transaction = queuedTransactions[i];
+        const unsigned char* receiveEnd = receiveIt + transaction.receiveSize;
+        if (transaction.failed)
+        {
+            receiveIt = receiveEnd;
+            continue;
+        }
+
+        size_t frameBegin = repeatBuffer.size();
+        repeatBuffer.push_back(repeatedFrameNodeNrOffset + transaction.nodeNr);
+        repeatBuffer.push_back(0);
+        repeatBuffer.push_back(transaction.receiveSize);
+        for (; receiveIt != receiveEnd; ++receiveIt)
+        {
+            repeatBuffer.push_back(*receiveIt + 128);
+            if (*receiveIt == charBlockReadIndex || *receiveIt == intBlockReadIndex)
+            {
+                ++receiveIt;
+                repeatBuffer.push_back(*receiveIt);
+            }
+        }
+
+        unsigned char checksum = 0;
+        for (size_t j = frameBegin; j != repeatBuffer.size(); ++j)
+        {
+            checksum -= repeatBuffer[j];
+        }
+        repeatBuffer[frameBegin + 1] = checksum;
+
+        transaction.writeEnd = repeatBuffer.size();
+    }
+
+    if (repeatBuffer.empty())
+    {
+        return;
+    }
+
+    size_t bytesSent = ::write(port.lowest_layer().native_handle(), &repeatBuffer[0], repeatBuffer.size());
+    if (bytesSent != repeatBuffer.size())
+    {
+        throw CommunicationError(queuedTransactions[transactionIndex].nodeNr, CommunicationError::COULD_NOT_SEND);
+    }
+}
+
+bool SerialCommunication::canRepeatFrame(const QueuedTransaction& transaction) const
+{
+    return transaction.nodeNr < repeatedFrameNodeNrOffset &&
+            static_cast<unsigned char>(nodeBuffers[transaction.nodeNr].charArray[15]) >=
+            repeatedFrameBreakingChangeNr;
+}
+
+size_t SerialCommunication::getResponseSize() const
+{
+    size_t size = 1;
+    for (auto it = receiveArray.begin(); it != receiveArray.end(); ++it)
+    {
+        if (*it == charBlockReadIndex || *it == intBlockReadIndex)
+        {
+            size_t valueSize = *it == intBlockReadIndex ? 2 : 1;
+            ++it;
+            size += 1 + ((*it & 0x0f) + 1) * valueSize;
+        }
+        else
+        {
+            size += *it >= 64 ? 3 : 2;
+        }
+    }
+
+    return size;
+}
+
+std::chrono::steady_clock::time_point SerialCommunication::getExpectedResponseTime(size_t transactionIndex,
+        std::chrono::steady_clock::time_point previousResponseTime) const
+{
+    using namespace std::chrono;
+    auto transferTime = [](size_t bytes)
+        {
+            return duration_cast<steady_clock::duration>(duration<double>(bytes * 10.0 / baudRate));
+        };
+
+    const auto& transaction = queuedTransactions[transactionIndex];
+
+    // The node answers when its frame has been sent and the previous response is received
+    steady_clock::time_point frameSentTime = lastWriteTime + transferTime(transaction.writeEnd);
+    return std::max(frameSentTime, previousResponseTime) + transferTime(transaction.responseSize);
+}
+
+const SerialCommunication::ResponseTimeHistogram* SerialCommunication::getResponseTimeHistogram(
+        unsigned char nr) const
+{
+    if (nodeBuffers[nr].responseTimes.getCount() >= minResponseTimeSamples)
+    {
+        return &nodeBuffers[nr].responseTimes;
+    }
+
+    if (busResponseTimes.getCount() >= minResponseTimeSamples)
+    {
+        return &busResponseTimes;
+    }
+
+    return nullptr;
+}
+
+std::chrono::steady_clock::time_point SerialCommunication::startResponseTimeout(size_t transactionIndex,
+        std::chrono::steady_clock::time_point expectedTime)
+{
+    using namespace std::chrono;
+
+    const auto& transaction = queuedTransactions[transactionIndex];
+    const ResponseTimeHistogram* histogram = getResponseTimeHistogram(transaction.nodeNr);
+    if (!adaptiveTimeoutsEnabled)
+    {
+        reader.start_timeout();
+        return steady_clock::now() + maxResponseTimeout;
+    }
+
+    if (histogram == nullptr)
+    {
+        steady_clock::time_point deadline = std::min(steady_clock::now() + maxResponseTimeout,
+                std::max(transactionDeadline, expectedTime));
+        reader.set_deadline(deadline);
+        return deadline;
+    }
+
+    auto toDuration = [](double seconds)
+        {
+            return duration_cast<steady_clock::duration>(duration<double>(seconds));
+        };
+
+    // The remaining cycle budget limits the time waited beyond the transfer time of the response
+    auto timeout = toDuration(getResponseTimeout(transaction.nodeNr));
+    steady_clock::time_point deadline = std::min(expectedTime + timeout, std::max(transactionDeadline, expectedTime));
+
+    // A silent node is detected when the first byte is overdue
+    auto remainingTransferTime = toDuration((transaction.responseSize - 1) * 10.0 / baudRate);
+    reader.set_deadline(std::min(expectedTime - remainingTransferTime + timeout, deadline));
+
+    return deadline;
+}
+
+bool SerialCommunication::resendFitsBeforeDeadline(size_t transactionIndex) const
+{
+    double expectedTime = 0.0;
+    for (size_t i = transactionIndex; i != queuedTransactions.size(); ++i)
+    {
+        expectedTime += nodeBuffers[queuedTransactions[i].nodeNr].transactionTime;
+    }
+
+    using namespace std::chrono;
+    return steady_clock::now() + duration_cast<steady_clock::duration>(duration<double>(expectedTime)) <=
+            transactionDeadline;
+}
+
+bool SerialCommunication::registerFailedTransaction(unsigned char nr)
+{
+    auto& status = nodeBuffers[nr].status;
+    status.lastTransactionOk = false;
+    ++status.consecutiveFailures;
+
+    return status.consecutiveFailures >= maxConsecutiveFailures;
+}
+
+void SerialCommunication::receiveResponse(unsigned char nodeNr,
+        const unsigned char* receiveBegin,
+        const unsigned char* receiveEnd,
+        std::chrono::steady_clock::time_point responseDeadline)
+{
+    auto& nodeBuffer = nodeBuffers[nodeNr];
+
+    char c = 0;
+    bool error = false;
+    for (auto it = receiveBegin; it != receiveEnd; ++it)
+    {
+        error = !reader.read_char(c);
+        if (error)
+        {
+            throw CommunicationError(nodeNr, CommunicationError::NO_RESPONSE);
+        }
+
+        if (it == receiveBegin)
+        {
+            reader.set_deadline(responseDeadline);
+        }
+
+        if (*it == c && (*it == charBlockReadIndex || *it == intBlockReadIndex))
+        {
+            bool intRegisters = *it == intBlockReadIndex;
+
+            // The parameter byte is not echoed
+            ++it;
+            size_t index = *it >> 4;
+            size_t endIndex = index + (*it & 0x0f) + 1;
+            for (; index != endIndex; ++index)
+            {
+                error = !reader.read_char(c);
+                if (error)
+                {
+                    throw CommunicationError(nodeNr, CommunicationError::PARTIAL_RESPONSE_TYPE_2);
+                }
+
+                if (intRegisters)
+                {
+                    short value = static_cast<unsigned char>(c);
+
+                    error = !reader.read_char(c);
+                    if (error)
+                    {
+                        throw CommunicationError(nodeNr, CommunicationError::PARTIAL_RESPONSE_TYPE_2);
+                    }
+                    value += static_cast<unsigned char>(c) * static_cast<unsigned short>(256);
+
+                    if (index < nodeBuffer.intArray.size())
+                    {
+                        nodeBuffer.intArray[index] = value;
+                    }
+                }
+                else if (index < nodeBuffer.charArray.size())
+                {
+                    nodeBuffer.charArray[index] = c;
+                }
+            }
+        }
+        else if (*it == c)
+        {
+            if (*it >= 64)
+            {
+                error = !reader.read_char(c);
+                if (error)
+                {
+                    throw CommunicationError(nodeNr, CommunicationError::PARTIAL_RESPONSE_TYPE_1);
+                }
+                short value = static_cast<unsigned char>(c);
+
+                error = !reader.read_char(c);
+                if (error)
+                {
+                    throw CommunicationError(nodeNr, CommunicationError::PARTIAL_RESPONSE_TYPE_2);
+                }
+                value += static_cast<unsigned char>(c) * static_cast<unsigned short>(256);
+                nodeBuffer.intArray.at(*it - 64) = value;
+            }
+            else
+            {
+                error = !reader.read_char(c);
+                if (error)
+                {
+                    throw CommunicationError(nodeNr, CommunicationError::PARTIAL_RESPONSE_TYPE_3);
+                }
+                nodeBuffer.charArray.at(*it) = c;
+            }
+        }
+        else
+        {
+            while (true)
+            {
+                error = !reader.read_char(c);
+                if (error)
+                {
+                    break;
+                }
+            }
+
+            throw CommunicationError(nodeNr, CommunicationError::UNEXPECTED_RESPONSE);
+        }
+    }
+    error = !reader.read_char(c);
+    if (error)
+    {
+        throw CommunicationError(nodeNr, CommunicationError::PARTIAL_RESPONSE_TYPE_4);
+    }
+    if (static_cast<unsigned char>(c) != 0xff)
+    {
+        throw CommunicationError(nodeNr, CommunicationError::CHECKSUM_ERROR);
+    }
+}
+
+void SerialCommunication::ResponseTimeHistogram::record(double seconds)
+{
+    size_t index = 0;
+    if (seconds > firstBucketEnd)
+    {
+        index = std::min(static_cast<size_t>(std::ceil(std::log2(seconds / firstBucketEnd) * bucketsPerOctave)),
+                bucketCount - 1);
+    }
+
+    ++buckets[index];
+    ++count;
+
+    if (count == decayInterval)
+    {
+        count = 0;
+        for (auto& b : buckets)
+        {
+            b /= 2;
+            count += b;
+        }
+    }
+}
+
+double SerialCommunication::ResponseTimeHistogram::getQuantile(double quantile) const
+{
+    double threshold = quantile * count;
+    uint32_t accumulatedCount = 0;
+    size_t i = 0;
+    for (; i != bucketCount - 1; ++i)
+    {
+        accumulatedCount += buckets[i];
+        if (accumulatedCount >= threshold)
+        {
+            break;
+        }
+    }
+
+    return firstBucketEnd * std::exp2(static_cast<double>(i) / bucketsPerOctave);
+}
+
+uint32_t SerialCommunication::ResponseTimeHistogram::getCount() const
+{
+    return count;
+}
+
+SerialCommunication::blocking_reader::blocking_reader(boost::asio::serial_port& port, size_t timeout) :
+                                            port(port), timeout(timeout)
+{
+    start_timeout();
+}
+
+void SerialCommunication::blocking_reader::flush()
+{
+    receiveBufferReadIndex = 0;
+    receiveBufferEndIndex = 0;
+
+    if (port.is_open())
+    {
+        ::tcflush(port.native_handle(), TCIFLUSH);
+    }
+}
+
+void SerialCommunication::blocking_reader::start_timeout()
+{
+    deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+}
+
+void SerialCommunication::blocking_reader::set_deadline(std::chrono::steady_clock::time_point newDeadline)
+{
+    deadline = newDeadline;
+}
+
+void SerialCommunication::blocking_reader::discard_until_quiet(std::chrono::steady_clock::duration quietTime)
+{
+    do
+    {
+        receiveBufferReadIndex = 0;
+        receiveBufferEndIndex = 0;
+        deadline = std::chrono::steady_clock::now() + quietTime;
+    }
+    while (fill_receive_buffer());
+}
+
+bool SerialCommunication::blocking_reader::fill_receive_buffer()
+{
+    using namespace std::chrono;
+
+    if (!port.is_open())
+    {
+        return false;
+    }
+
+    int fd = port.native_handle();
+
+    while (true)
+    {
+        auto timeLeft = deadline - steady_clock::now();
+        if (timeLeft <= steady_clock::duration::zero())
+        {
+            return false;
+        }
+
+        auto timeLeftNs = duration_cast<nanoseconds>(timeLeft).count();
+        timespec timeLeftSpec{static_cast<time_t>(timeLeftNs / 1000000000),
+                static_cast<long>(timeLeftNs % 1000000000)};
+
+        pollfd pollFd{fd, POLLIN, 0};
+        int pollResult = ::ppoll(&pollFd, 1, &timeLeftSpec, nullptr);
+        if (pollResult < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (pollResult <= 0)
+        {
+            return false;
+        }
+
+        ssize_t bytesRead = ::read(fd, receiveBuffer.data(), receiveBuffer.size());
+        if (bytesRead < 0 && (errno == EINTR || errno == EAGAIN))
+        {
+            continue;
+        }
+        if (bytesRead <= 0)
+        {
+            return false;
+        }
+
+        receiveBufferReadIndex = 0;
+        receiveBufferEndIndex = bytesRead;
+        return true;
+    }
+}
+
+bool SerialCommunication::blocking_reader::read_char(char& val)
+{
+    val = '\0';
+
+    if (receiveBufferReadIndex == receiveBufferEndIndex)
+    {
+        if (!fill_receive_buffer())
+        {
+            return false;
+        }
+    }
+
+    val = receiveBuffer[receiveBufferReadIndex];
+    ++receiveBufferReadIndex;
+
+    return true;
+}
+
+// Plant model of the firmware's SimulationHandler
+static constexpr float simPlantA01 = 0.0005963881634343555f;
+static constexpr float simPlantA11 = 0.9879847514731415f;
+static constexpr float simPlantB0 = 1.6030177484362372e-05f;
+static constexpr float simPlantB1 = 0.05332648997363798f;
+static constexpr float simPlantBackEmf = -0.0001397607579124993f;
+static constexpr float simPlantFriction = 60.0f;
+static constexpr float simPlantPwmOffset = 500.0f;
+
+// Control model and Kalman filter polynomial of the firmware's defaultSim configuration
+static constexpr float simModelA01 = 0.0006f;
+static constexpr float simModelA11 = 1.0f;
+static constexpr float simModelB0 = 1.7999999999999997e-07f;
+static constexpr float simModelB1 = 0.0006f;
+static constexpr std::array<std::array<double, 7>, 3> simModelPolyK{{
+        {-1.9824914858583672e-23, 6.808150830005707e-19, -1.0246881046334478e-14, 8.979468650052665e-11,
+            -5.028779989915877e-07, 0.0017548254273752164, 0.0014220749321045931},
+        {2.511086124189635e-19, -7.0053853588061025e-15, 7.649342768550831e-11, -3.997017418475635e-07,
+            0.0008714473464777145, 0.4337783328664848, -61.68698076064478},
+        {5.268302746974665e-17, -1.9704278703366155e-12, 2.9001435813756453e-08, -0.00020808122063929412,
+            0.6790744641735348, -286.70053636075215, 35440.208679119176}}};
+// The simulated servos report breaking change 0, so velocities are not upscaled
+static constexpr float simPositionUpscaling = 32.0f;
+static constexpr float simVelocityUpscaling = 1.0f;
+
+static constexpr float simMaxVelocity = 4096.0f * 10.0f / 1 * 11.0f / 62 * 14.0f / 48 * 13.0f / 45 * 1.0f / 42 *
+        (1.0f / simModelA01 / 2.0f * 0.8f);
+
+size_t SimulateCommunication::ServoSim::size() const
+{
+    return charArray.size();
+}
+
+void SimulateCommunication::ServoSim::addServo()
+{
+    charArray.push_back({0});
+    intArray.push_back({0});
+    charArrayChanged.push_back({false});
+    intArrayChanged.push_back({false});
+
+    if (blocks.size() * blockSize < size())
+    {
+        blocks.push_back(Block());
+    }
+
+    controlSpeed.push_back(50);
+    velControlSpeed.push_back(50 * 4);
+    filterSpeed.push_back(20 * 4 * 4);
+    inertiaMarg.push_back(1.0f);
+
+    size_t i = size() - 1;
+    updateControlParameters(i);
+    filterSpeed[i] = 50 * 4 * 8;
+}
+
+void SimulateCommunication::ServoSim::step()
+{
+    for (auto& b : blocks)
+    {
+        for (size_t j = 0; j != blockSize; ++j)
+        {
+            const float enabled = b.controlEnabled[j];
+            const float closedLoop = enabled * (1.0f - b.openLoopMode[j]);
+            const float openLoopActive = enabled - closedLoop;
+
+            float xhat0 = b.xhat0[j];
+            float xhat1 = b.xhat1[j];
+            float xhat2 = b.xhat2[j];
+            const float y = b.plantPos[j];
+            const float v = b.plantVel[j];
+
+            float ivel = b.ivel[j] + b.pendingIntegralCalc[j] *
+                    (b.l2[j] * (b.vControlRef[j] - xhat1) - b.l3[j] * (b.controlSignal[j] - b.pwm[j]));
+            ivel *= closedLoop;
+
+            const float posRef = b.posRef[j] + b.velRef[j] * static_cast<float>(cycleTime);
+
+            const float error = y - xhat0;
+            xhat0 += b.k0[j] * error;
+            xhat1 += b.k1[j] * error;
+            xhat2 += b.k2[j] * error;
+
+            const float posDiff = posRef - xhat0;
+            const float vControlRef = std::min(std::max(b.l0[j] * posDiff + b.velRef[j],
+                    -simMaxVelocity), simMaxVelocity);
+            const float u = std::min(std::max(b.l1[j] * (vControlRef - xhat1) + ivel, -32768.0f), 32767.0f);
+
+            const float feedForward = b.feedForward[j];
+            const float kalmanU = closedLoop * u + openLoopActive * feedForward * (1.0f - b.pwmOpenLoopMode[j]);
+            const float controlSignal = closedLoop * (u + feedForward) + openLoopActive * feedForward;
+            const float pwm = std::min(std::max(controlSignal, -1023.0f), 1023.0f);
+
+            const float uComp = xhat2 + kalmanU;
+            xhat0 += simModelA01 * xhat1 + simModelB0 * uComp;
+            xhat1 = simModelA11 * xhat1 + simModelB1 * uComp;
+
+            const float pwmSign = (pwm > 0.0f) - (pwm < 0.0f);
+            const float velSign = (v > 0.0f) - (v < 0.0f);
+            float uSim = pwmSign * std::max(std::abs(pwm) - simPlantPwmOffset, 0.0f) *
+                    (1023.0f / (1023.0f - simPlantPwmOffset));
+            uSim += simPlantBackEmf * v * std::abs(uSim);
+            const float uSimFric = uSim - simPlantFriction * velSign;
+            const float newVel = simPlantA11 * v + simPlantB1 * uSimFric;
+            const bool stuck = ((uSim == 0.0f) | ((uSim < 0.0f) != (uSimFric < 0.0f))) &
+                    ((newVel < 0.0f) != (v < 0.0f));
+
+            b.xhat0[j] = xhat0;
+            b.xhat1[j] = xhat1;
+            b.xhat2[j] = xhat2;
+            b.ivel[j] = ivel;
+            b.posRef[j] = enabled * posRef + (1.0f - enabled) * y;
+            b.velRef[j] *= enabled;
+            b.feedForward[j] = enabled * feedForward;
+            b.posDiff[j] = posDiff;
+            b.vControlRef[j] = vControlRef;
+            b.controlSignal[j] = controlSignal;
+            b.pwm[j] = pwm;
+            b.pendingIntegralCalc[j] = closedLoop;
+            b.plantPos[j] = stuck ? y : y + simPlantA01 * v + simPlantB0 * uSimFric;
+            b.plantVel[j] = stuck ? 0.0f : newVel;
+        }
+    }
+
+    ++loopNr;
+}
+
+void SimulateCommunication::ServoSim::updateRegisters(size_t i)
+{
+    const auto& b = blocks[i / blockSize];
+    const size_t j = i % blockSize;
+
+    auto clampToShort = [](float v)
+        {
+            return static_cast<short int>(std::min(std::max(v, -32768.0f), 32767.0f));
+        };
+
+    long int pos = static_cast<long int>(b.plantPos[j] * simPositionUpscaling);
+    intArray[i][3] = static_cast<short int>(pos);
+    charArray[i][9] = static_cast<char>(pos >> 16);
+    intArray[i][4] = static_cast<short int>(clampToShort(b.xhat1[j]) * simVelocityUpscaling);
+    intArray[i][5] = clampToShort(b.controlSignal[j]);
+    intArray[i][6] = clampToShort(b.pwm[j]);
+    intArray[i][7] = clampToShort(b.pwm[j]);
+    intArray[i][10] = static_cast<short int>(pos);
+    intArray[i][11] = 0;
+
+    charArray[i][11] = static_cast<char>(loopNr);
+    charArray[i][12] = static_cast<char>(std::min(std::max(b.posDiff[j] * 1000, -128.0f), 127.0f));
+}
+
+void SimulateCommunication::ServoSim::applyRegisters(size_t i)
+{
+    auto& b = blocks[i / blockSize];
+    const size_t j = i % blockSize;
+
+    auto& c = charArray[i];
+    auto& changed = charArrayChanged[i];
+    if (changed[3] || changed[4] || changed[5] || changed[10])
+    {
+        if (!changed[4] && !changed[5])
+        {
+            c[4] = c[3];
+            c[5] = c[3];
+        }
+        controlSpeed[i] = c[3];
+        velControlSpeed[i] = static_cast<unsigned char>(c[4]) * 4;
+        filterSpeed[i] = static_cast<unsigned char>(c[5]) * 32;
+        inertiaMarg[i] = 1.0f + static_cast<unsigned char>(c[10]) * (1.0f / 128);
+    }
+    changed.fill(false);
+
+    bool wasEnabled = b.controlEnabled[j] != 0.0f;
+    if (intArrayChanged[i][0])
+    {
+        long int upscaledPos = static_cast<long int>(b.plantPos[j] * simPositionUpscaling);
+        upscaledPos += static_cast<short int>(intArray[i][0] - static_cast<short int>(upscaledPos));
+        b.posRef[j] = upscaledPos * (1.0f / simPositionUpscaling);
+        b.velRef[j] = intArray[i][1] * (1.0f / simVelocityUpscaling);
+        b.feedForward[j] = intArray[i][2];
+        b.openLoopMode[j] = 0.0f;
+        b.controlEnabled[j] = 1.0f;
+    }
+    else if (intArrayChanged[i][2])
+    {
+        b.posRef[j] = b.plantPos[j];
+        b.velRef[j] = 0.0f;
+        b.feedForward[j] = intArray[i][2];
+        b.openLoopMode[j] = 1.0f;
+        b.pwmOpenLoopMode[j] = c[1] == 1 ? 1.0f : 0.0f;
+        b.controlEnabled[j] = 1.0f;
+    }
+    else
+    {
+        b.controlEnabled[j] = 0.0f;
+    }
+    intArrayChanged[i].fill(false);
+
+    if (!wasEnabled && b.controlEnabled[j] != 0.0f)
+    {
+        updateControlParameters(i);
+    }
+}
+
+void SimulateCommunication::ServoSim::updateControlParameters(size_t i)
+{
+    auto& b = blocks[i / blockSize];
+    const size_t j = i % blockSize;
+
+    const float dt = simModelA01;
+    const float a = simModelA11;
+    const float bm = simModelB1;
+
+    float posControlPole = std::exp(-dt * controlSpeed[i]);
+    float velControlPole = std::exp(-1.0f * dt * velControlSpeed[i]);
+    velControlPole = std::min(std::min(velControlPole, a), 1.0f);
+
+    // see section 'Calculating the control parameters' of Doc/Theory.md for derivation of control equations
+    const float& m = inertiaMarg[i];
+    float L1 = m * (a - 2.0f * velControlPole + 1.0f)
+            + 2.0f * std::sqrt(m * (m - 1.0f) * (1.0f - velControlPole) * (a - velControlPole));
+    float L2 = (L1 * L1 / m + (a - 1.0f) * (m * (a - 1.0f) - 2.0f * L1)) / 4.0f;
+
+    b.l0[j] = (1.0f - posControlPole) / dt;
+    b.l1[j] = L1 / bm;
+    b.l2[j] = L2 / bm;
+    b.l3[j] = std::min(10 * b.l2[j], 0.1f);
+
+    float velControlPoleAtInertiaMarg = 0.5f * (a - bm * b.l1[j] / m + 1.0f);
+    unsigned short int minFilterSpeed = static_cast<unsigned short int>(std::round(
+            -std::log(velControlPoleAtInertiaMarg) / dt * filterSpeed[i] /
+            std::max<unsigned short int>(velControlSpeed[i], 1)));
+    double s = std::max(filterSpeed[i], minFilterSpeed);
+
+    std::array<double, 3> K;
+    for (size_t r = 0; r != 3; ++r)
+    {
+        K[r] = 0.0;
+        for (auto c : simModelPolyK[r])
+        {
+            K[r] = K[r] * s + c;
+        }
+    }
+
+    // The Kalman filter applies the inverse of the model A matrix times K
+    b.k0[j] = K[0] - dt * K[1] + simModelB0 * K[2];
+    b.k1[j] = K[1] - dt * K[2];
+    b.k2[j] = K[2];
+}
+
+SimulateCommunication::SimulateCommunication() :
+    SimulateCommunication(SteadyClock::getInstance())
+{
+}
+
+SimulateCommunication::SimulateCommunication(std::shared_ptr<Clock> clock) :
+    clock{clock},
+    startTime{clock->now()}
+{
+}
+
+std::shared_ptr<Clock> SimulateCommunication::getClock() const
+{
+    return clock;
+}
+
+std::vector<SerialCommunication::DiscoveredNode> SimulateCommunication::discoverNodes(
+        unsigned char firstNodeNr, unsigned char lastNodeNr, double timeout)
+{
+    std::vector<DiscoveredNode> nodes;
+    for (size_t i = 0; i != servoSims.size(); ++i)
+    {
+        unsigned char nr = i + 1;
+        if (nr >= firstNodeNr && nr <= lastNodeNr)
+        {
+            nodes.push_back(DiscoveredNode{nr, static_cast<unsigned char>(servoSims.charArray[i][15])});
+        }
+    }
+    return nodes;
+}
+
+void SimulateCommunication::stepServoSims()
+{
+    using namespace std::chrono;
+    uint64_t loops = static_cast<uint64_t>(duration<double>(clock->now() - startTime).count() /
+            ServoSim::cycleTime);
+
+    for (; steppedLoops < loops; ++steppedLoops)
+    {
+        servoSims.step();
+    }
+}
+
+void SimulateCommunication::execute()
+{
+    while (servoSims.size() < nodeNr)
+    {
+        servoSims.addServo();
+    }
+
+    stepServoSims();
+
+    const size_t servoIndex = nodeNr - 1;
+    auto& charArray = servoSims.charArray[servoIndex];
+    auto& intArray = servoSims.intArray[servoIndex];
+    servoSims.updateRegisters(servoIndex);
+
+    nodeBuffers[nodeNr].status.lastTransactionOk = true;
+
+    for (auto it = commandArray.begin(); it != commandArray.end(); ++it)
+    {
+        if (*it == charBlockReadIndex + 128 || *it == intBlockReadIndex + 128)
+        {
+            //block read request, skip the parameter byte
+            ++it;
+        }
+        else if (*it >= 128)
+        {
+            //read request, do nothing in sim
+        }
+        else if (*it >= 64)
+        {
+            const unsigned char intNr = *it - 64;
+            ++it;
+            short value = static_cast<unsigned char>(*it);
+            ++it;
+            value += static_cast<unsigned char>(*it) * static_cast<unsigned short>(256);
+            intArray.at(intNr) = value;
+            servoSims.intArrayChanged[servoIndex].at(intNr) = true;
+        }
+        else
+        {
+            const unsigned char charNr = *it;
+            ++it;
+            charArray.at(charNr) = static_cast<unsigned char>(*it);
+            servoSims.charArrayChanged[servoIndex].at(charNr) = true;
+        }
+    }
+
+    commandArray.clear();
+
+    for (auto it = receiveArray.begin(); it != receiveArray.end(); ++it)
+    {
+        if (*it == charBlockReadIndex || *it == intBlockReadIndex)
+        {
+            bool intRegisters = *it == intBlockReadIndex;
+            ++it;
+            size_t endIndex = std::min<size_t>((*it >> 4) + (*it & 0x0f) + 1, 16);
+            for (size_t i = *it >> 4; i < endIndex; ++i)
+            {
+                if (intRegisters)
+                {
+                    nodeBuffers[nodeNr].intArray[i] = intArray[i];
+                }
+                else
+                {
+                    nodeBuffers[nodeNr].charArray[i] = charArray[i];
+                }
+            }
+        }
+        else if (*it >= 64)
+        {
+            short value = intArray.at(*it - 64);
+            nodeBuffers[nodeNr].intArray.at(*it - 64) = value;
+        }
+        else
+        {
+            char value = charArray.at(*it);
+            nodeBuffers[nodeNr].charArray.at(*it) = value;
+        }
+    }
+
+    receiveArray.clear();
+
+    servoSims.applyRegisters(servoIndex);
+}
+
+void SimulateCommunication::queueExecute()
+{
+    execute();
+}
+
+bool SimulateCommunication::writeBroadcastReference(short int, short int, short int)
+{
+    return false;
+}
+
+LinkCalibrationCache::LinkCalibrationCache(const std::string& fileName) :
+    fileName{fileName}
+{
+    std::ifstream file(fileName);
+    std::string line;
+    while (std::getline(file, line))
+    {
+        std::istringstream lineStream(line);
+        std::string busName;
+        unsigned int nodeNr;
+        unsigned int breakingChangeNr;
+        Entry entry;
+        if (lineStream >> busName >> nodeNr >> breakingChangeNr >> entry.loopCycleTime &&
+                nodeNr < 256 && breakingChangeNr < 256)
+        {
+            entry.breakingChangeNr = breakingChangeNr;
+            entries[{busName, nodeNr}] = entry;
+        }
+    }
+}
+
+bool LinkCalibrationCache::get(const std::string& busName, unsigned char nodeNr, Entry& entry) const
+{
+    const std::lock_guard<std::mutex> lock(mutex);
+    auto it = entries.find({busName, nodeNr});
+    if (it == entries.end())
+    {
+        return false;
+    }
+    entry = it->second;
+    return true;
+}
+
+void LinkCalibrationCache::set(const std::string& busName, unsigned char nodeNr, const Entry& entry)
+{
+    const std::lock_guard<std::mutex> lock(mutex);
+    entries[{busName, nodeNr}] = entry;
+
+    try
+    {
+        save();
+        saveError.clear();
+    }
+    catch (std::exception& e)
+    {
+        saveError = e.what();
+    }
+}
+
+std::string LinkCalibrationCache::getSaveError() const
+{
+    const std::lock_guard<std::mutex> lock(mutex);
+    return saveError;
+}
+
+void LinkCalibrationCache::save()
+{
+    // Written to a temporary file and renamed, so that a crash never leaves a partial file
+    std::string tempFileName = fileName + ".tmp";
+    {
+        std::ofstream file(tempFileName, std::ios::trunc);
+        file << std::setprecision(17);
+        for (const auto& e : entries)
+        {
+            file << e.first.first << ' ' << static_cast<unsigned int>(e.first.second) << ' ' <<
+                    static_cast<unsigned int>(e.second.breakingChangeNr) << ' ' << e.second.loopCycleTime << '\n';
+        }
+        if (!file)
+        {
+            throw std::runtime_error("Could not write link calibration cache " + tempFileName);
+        }
+    }
+
+    if (std::rename(tempFileName.c_str(), fileName.c_str()) != 0)
+    {
+        throw std::runtime_error("Could not write link calibration cache " + fileName);
+    }
+}
+
+DCServoCommunicator::DCServoCommunicator(unsigned char nodeNr, Communication* bus) :
+    remoteTimeHandler{bus->getClock()}
+{
+    activeIntReads.fill(true);
+    activeCharReads.fill(true);
+    this->nodeNr = nodeNr;
+    this->bus = bus;
+
+    communicationIsOk = false;
+    initState = 0;
+    backlashControlDisabled = false;
+    newPositionReference = false;
+    newOpenLoopControlSignal = false;
+
+    setOffsetAndScaling(1.0, 0);
+}
+
+void DCServoCommunicator::setOffsetAndScaling(double scale, double offset, double startPosition)
+{
+	this->scale = scale;
+	this->offset = offset;
+    this->startPosition = startPosition;
+
+    if (isInitComplete())
+    {
+        updateOffset();
+    }
+}
+
+void DCServoCommunicator::setLinkCalibrationCache(std::shared_ptr<LinkCalibrationCache> cache)
+{
+    linkCalibrationCache = cache;
+    linkCalibrationCached = cache && !bus->getName().empty() &&
+            cache->get(bus->getName(), nodeNr, cachedLinkCalibration);
+}
+
+void DCServoCommunicator::updateOffset()
+{
+    float pos = getPosition() / scale;
+    startPosition /= scale;
+
+    long int wrapSize = (1l << 24) / positionUpscaling;
+
+    if (pos - startPosition > wrapSize / 2)
+    {
+        offset -= wrapSize * scale;
     }
     else if (pos - startPosition < -wrapSize / 2)
     {
-        offset += wrapSize * scale;
+        offset += wrapSize * scale;
+    }
+}
+
+void DCServoCommunicator::setControlSpeed(unsigned char controlSpeed, double inertiaMarg)
+{
+    setControlSpeed(controlSpeed, controlSpeed * 4, controlSpeed * 32, inertiaMarg);
+}
+
+void DCServoCommunicator::setControlSpeed(unsigned char controlSpeed,
+        unsigned short int velControlSpeed, unsigned short int filterSpeed,
+        double inertiaMarg)
+{
+    this->controlSpeed = controlSpeed;
+    this->velControlSpeed = velControlSpeed;
+    this->filterSpeed = filterSpeed;
+    inertiaMarg = std::min(std::max(inertiaMarg, 1.0), 1.0 + 255.0 / 128);
+    this->inertiaMarg = static_cast<unsigned char>(std::round((inertiaMarg - 1.0) * 128.0));
+}
+
+void DCServoCommunicator::setBacklashControlSpeed(unsigned char backlashCompensationSpeed,
+            double backlashCompensationCutOffSpeed,
+            double backlashSize)
+{
+    this->backlashCompensationSpeed = backlashCompensationSpeed;
+    this->backlashCompensationSpeedVelDecrease = static_cast<unsigned char>(std::min(255.0,
+            255 * 10 / (backlashCompensationCutOffSpeed / std::abs(scale))));
+    this->backlashSize = static_cast<unsigned char>(backlashSize / std::abs(scale));
+}
+
+void DCServoCommunicator::setFrictionCompensation(double fricComp)
+{
+    this->frictionCompensation = fricComp;
+}
+
+
+void DCServoCommunicator::disableBacklashControl(bool b)
+{
+    backlashControlDisabled = b;
+    updateReadSchedule();
+}
+
+bool DCServoCommunicator::isInitComplete() const
+{
+    return (initState >= 10 || linkCalibrationValidated) and remoteTimeHandler.isInitialized();
+}
+
+bool DCServoCommunicator::isCommunicationOk() const
+{
+    return communicationIsOk;
+}
+
+CommunicationStatus DCServoCommunicator::getCommunicationStatus() const
+{
+    return bus->getCommunicationStatus(nodeNr);
+}
+
+void DCServoCommunicator::setReference(const float& pos, const float& vel, const float& feedforwardU)
+{
+    newPositionReference = true;
+    newOpenLoopControlSignal = false;
+    userReference = {pos, vel, feedforwardU};
+    refPos = std::round((pos - offset) / scale * positionUpscaling);
+    refVel = std::round(vel / scale * velocityUpscaling);
+
+    if (refVel > 4 * velocityUpscaling)
+    {
+        frictionCompensation = std::abs(frictionCompensation);
+    }
+    else if (refVel < -4 * velocityUpscaling)
+    {
+        frictionCompensation = -std::abs(frictionCompensation);
+    }
+    this->feedforwardU = std::round(feedforwardU + frictionCompensation);
+
+    if (timedReferences)
+    {
+        requestCharRead(11);
+    }
+}
+
+void DCServoCommunicator::enableTimedReferences(bool enable)
+{
+    timedReferences = enable;
+}
+
+bool DCServoCommunicator::isTimedReferencesEnabled() const
+{
+    return timedReferences;
+}
+
+void DCServoCommunicator::setReferenceApplyTime(double localTime)
+{
+    referenceApplyTime = localTime;
+}
+
+void DCServoCommunicator::setOpenLoopControlSignal(const float& feedforwardU, bool pwmMode)
+{
+    newOpenLoopControlSignal = true;
+    newPositionReference = false;
+    pwmOpenLoopMode = pwmMode;
+    this->feedforwardU = feedforwardU;
+}
+
+float DCServoCommunicator::getPosition(bool withBacklash) const
+{
+    if (withBacklash && !backlashControlDisabled)
+    {
+        requestIntRead(3);
+    }
+    else
+    {
+        requestIntRead(10);
+    }
+
+    return calculatePosition(withBacklash);
+}
+
+float DCServoCommunicator::getVelocity() const
+{
+    requestIntRead(4);
+    return scale * encoderVel;
+}
+
+float DCServoCommunicator::getControlSignal() const
+{
+    requestIntRead(5);
+    return controlSignal;
+}
+
+float DCServoCommunicator::getFeedforwardU() const
+{
+    return activeFeedforwardU[2];
+}
+
+float DCServoCommunicator::getControlError(bool withBacklash) const
+{
+    if (!backlashControlDisabled)
+    {
+        if (withBacklash)
+        {
+            requestIntRead(3);
+        }
+        else
+        {
+            requestIntRead(10);
+            requestIntRead(11);
+        }
+    }
+    else
+    {
+        requestIntRead(10);
+    }
+
+    return calculateControlError(withBacklash);
+}
+
+float DCServoCommunicator::getCurrent() const
+{
+    requestIntRead(6);
+    return current;
+}
+
+short int DCServoCommunicator::getPwmControlSignal() const
+{
+    requestIntRead(7);
+    return pwmControlSignal;
+}
+
+short int DCServoCommunicator::getCpuLoad() const
+{
+    requestIntRead(8);
+    return cpuLoad;
+}
+
+short int DCServoCommunicator::getLoopTime() const
+{
+    requestIntRead(9);
+    return loopTime;
+}
+
+double DCServoCommunicator::getTime() const
+{
+    requestCharRead(11);
+    return remoteTimeHandler.get();
+}
+
+double DCServoCommunicator::getLocalTimeOfRemoteTime(double remoteTime) const
+{
+    requestCharRead(11);
+    return remoteTimeHandler.toLocalTime(remoteTime);
+}
+
+double DCServoCommunicator::getRemoteTimeOfLocalTime(double localTime) const
+{
+    requestCharRead(11);
+    return remoteTimeHandler.toRemoteTime(localTime);
+}
+
+double DCServoCommunicator::getClockDrift() const
+{
+    requestCharRead(11);
+    return remoteTimeHandler.getDrift();
+}
+
+double DCServoCommunicator::getTimeSyncError() const
+{
+    requestCharRead(11);
+    return remoteTimeHandler.getSyncError();
+}
+
+float DCServoCommunicator::getBacklashCompensation() const
+{
+    requestIntRead(11);
+    return scale * backlashCompensation;
+}
+
+DCServoCommunicator::OpticalEncoderChannelData DCServoCommunicator::getOpticalEncoderChannelData() const
+{
+    requestIntRead(12);
+    requestIntRead(13);
+    requestIntRead(14);
+    requestIntRead(15);
+    return opticalEncoderChannelData;
+}
+
+float DCServoCommunicator::getLowLevelControlError() const
+{
+    requestCharRead(12);
+    return scale * lowLevelControlError;
+}
+
+float DCServoCommunicator::calculatePosition(bool withBacklash) const
+{
+    float pos;
+    if (withBacklash && !backlashControlDisabled)
+    {
+        pos = backlashEncoderPos;
+    }
+    else
+    {
+        pos = encoderPos;
+    }
+
+    return scale * pos + offset;
+}
+
+float DCServoCommunicator::calculateControlError(bool withBacklash) const
+{
+    float pos;
+    if (!backlashControlDisabled)
+    {
+        if (withBacklash)
+        {
+            pos = backlashEncoderPos;
+        }
+        else
+        {
+            pos = encoderPos + backlashCompensation;
+        }
+    }
+    else
+    {
+        pos = encoderPos;
+    }
+
+    return scale * (activeRefPos[2] * (1.0 / positionUpscaling) - pos);
+}
+
+void DCServoCommunicator::getState(ServoState& state) const
+{
+    state.position = calculatePosition(true);
+    state.velocity = scale * encoderVel;
+    state.current = current;
+    state.controlError = calculateControlError(true);
+    state.loopTime = loopTime;
+    state.remoteTime = remoteTimeHandler.get();
+    state.communicationOk = communicationIsOk;
+    state.referencePosition = userReference[0];
+    state.referenceVelocity = userReference[1];
+    state.referenceFeedForward = userReference[2];
+    state.referenceSent = referenceSent;
+}
+
+void DCServoCommunicator::requestIntRead(size_t i) const
+{
+    if (intReadSchedules[i].divisor == 0)
+    {
+        activeIntReads[i] = true;
+    }
+}
+
+void DCServoCommunicator::requestCharRead(size_t i) const
+{
+    if (charReadSchedules[i].divisor == 0)
+    {
+        activeCharReads[i] = true;
+    }
+}
+
+void DCServoCommunicator::setPollingDivisor(ReadValue value, unsigned int divisor)
+{
+    pollingDivisors[static_cast<size_t>(value)] = divisor;
+    updateReadSchedule();
+}
+
+unsigned int DCServoCommunicator::getPollingDivisor(ReadValue value) const
+{
+    return pollingDivisors[static_cast<size_t>(value)];
+}
+
+void DCServoCommunicator::updateReadSchedule()
+{
+    class ScheduledRegister
+    {
+    public:
+        ReadSchedule* schedule;
+        unsigned int replyBytes;
+    };
+
+    std::array<ReadSchedule, 16> newIntReadSchedules;
+    std::array<ReadSchedule, 16> newCharReadSchedules;
+
+    auto subscribe = [](ReadSchedule& schedule, unsigned int divisor)
+        {
+            if (divisor != 0 && (schedule.divisor == 0 || divisor < schedule.divisor))
+            {
+                schedule.divisor = divisor;
+            }
+        };
+
+    auto divisor = [this](ReadValue value){ return pollingDivisors[static_cast<size_t>(value)]; };
+
+    subscribe(newIntReadSchedules[backlashControlDisabled ? 10 : 3], divisor(ReadValue::position));
+    subscribe(newIntReadSchedules[10], divisor(ReadValue::encoderPosition));
+    subscribe(newIntReadSchedules[4], divisor(ReadValue::velocity));
+    subscribe(newIntReadSchedules[5], divisor(ReadValue::controlSignal));
+    subscribe(newIntReadSchedules[6], divisor(ReadValue::current));
+    subscribe(newIntReadSchedules[7], divisor(ReadValue::pwmControlSignal));
+    subscribe(newIntReadSchedules[8], divisor(ReadValue::cpuLoad));
+    subscribe(newIntReadSchedules[9], divisor(ReadValue::loopTime));
+    subscribe(newCharReadSchedules[11], divisor(ReadValue::time));
+    subscribe(newIntReadSchedules[11], divisor(ReadValue::backlashCompensation));
+    for (size_t i = 12; i != 16; ++i)
+    {
+        subscribe(newIntReadSchedules[i], divisor(ReadValue::opticalEncoderChannelData));
+    }
+    subscribe(newCharReadSchedules[12], divisor(ReadValue::lowLevelControlError));
+
+    // Place the registers read less often than every cycle, the most frequent first, at the phase
+    // that gives the lowest peak frame size. The load is tracked over the least common multiple
+    // of the divisors, limited in length so that large coprime divisors only approximate it.
+    std::vector<ScheduledRegister> slowRegisters;
+    size_t scheduleLength = 1;
+    for (size_t i = 0; i != 16; ++i)
+    {
+        for (auto r : {ScheduledRegister{&newIntReadSchedules[i], 3}, ScheduledRegister{&newCharReadSchedules[i], 2}})
+        {
+            if (r.schedule->divisor > 1)
+            {
+                slowRegisters.push_back(r);
+                scheduleLength = std::min<size_t>(std::lcm<size_t>(scheduleLength, r.schedule->divisor), 1 << 12);
+            }
+        }
+    }
+
+    std::stable_sort(slowRegisters.begin(), slowRegisters.end(),
+            [](const ScheduledRegister& lhs, const ScheduledRegister& rhs){
+                return lhs.schedule->divisor < rhs.schedule->divisor; });
+
+    std::vector<unsigned int> load(scheduleLength, 0);
+    for (auto& r : slowRegisters)
+    {
+        unsigned int d = r.schedule->divisor;
+        unsigned int bestPhase = 0;
+        unsigned int bestPeak = std::numeric_limits<unsigned int>::max();
+        for (unsigned int phase = 0; phase != d && phase != scheduleLength; ++phase)
+        {
+            unsigned int peak = 0;
+            for (size_t i = phase; i < scheduleLength; i += d)
+            {
+                peak = std::max(peak, load[i]);
+            }
+            if (peak < bestPeak)
+            {
+                bestPeak = peak;
+                bestPhase = phase;
+            }
+        }
+
+        r.schedule->phase = bestPhase;
+        for (size_t i = bestPhase; i < scheduleLength; i += d)
+        {
+            load[i] += 1 + r.replyBytes;
+        }
+    }
+
+    intReadSchedules = newIntReadSchedules;
+    charReadSchedules = newCharReadSchedules;
+}
+
+void DCServoCommunicator::requestReads(const std::array<bool, 16>& requested, bool intRegisters)
+{
+    // A single read costs a command byte and an echoed index byte, a block read also a
+    // parameter byte. Registers in a block that were not requested cost their value bytes.
+    const size_t singleReadOverhead = 2;
+    const size_t blockReadOverhead = 3;
+    const size_t valueSize = intRegisters ? 2 : 1;
+
+    size_t i = 0;
+    while (i != requested.size())
+    {
+        if (!requested[i])
+        {
+            ++i;
+            continue;
+        }
+
+        size_t last = i;
+        size_t nrOfRequested = 1;
+        for (size_t j = i + 1; j != requested.size(); ++j)
+        {
+            if (requested[j])
+            {
+                if ((j - last - 1) * valueSize >= blockReadOverhead)
+                {
+                    break;
+                }
+                last = j;
+                ++nrOfRequested;
+            }
+        }
+
+        size_t blockSize = last - i + 1;
+        size_t blockCost = blockReadOverhead + (blockSize - nrOfRequested) * valueSize;
+        if (breakingChangeNr >= 2 && blockCost < nrOfRequested * singleReadOverhead)
+        {
+            if (intRegisters)
+            {
+                bus->requestReadIntBlock(i, blockSize);
+            }
+            else
+            {
+                bus->requestReadCharBlock(i, blockSize);
+            }
+        }
+        else
+        {
+            for (size_t j = i; j <= last; ++j)
+            {
+                if (requested[j])
+                {
+                    if (intRegisters)
+                    {
+                        bus->requestReadInt(j);
+                    }
+                    else
+                    {
+                        bus->requestReadChar(j);
+                    }
+                }
+            }
+        }
+
+        i = last + 1;
+    }
+}
+
+bool DCServoCommunicator::isScheduledRead(const ReadSchedule& schedule) const
+{
+    return schedule.divisor != 0 && readScheduleCycleNr % schedule.divisor == schedule.phase;
+}
+
+double DCServoCommunicator::getScaling() const
+{
+    return scale;
+}
+
+double DCServoCommunicator::getOffset() const
+{
+    return offset;
+}
+
+unsigned char DCServoCommunicator::getNodeNr() const
+{
+    return nodeNr;
+}
+
+Communication* DCServoCommunicator::getBus() const
+{
+    return bus;
+}
+
+void DCServoCommunicator::run()
+{
+    prepareRun();
+    bus->execute();
+    completeRun();
+}
+
+void DCServoCommunicator::queueRun()
+{
+    prepareRun();
+    bus->queueExecute();
+}
+
+void DCServoCommunicator::prepareRun()
+{
+    bus->setNodeNr(nodeNr);
+
+    bool initComplete = isInitComplete();
+    if (!initComplete)
+    {
+        remoteTimeHandler.startSample();
+    }
+
+    // The init sequence only reads the loop number for the time synchronization samples,
+    // to keep the rounds short. The positions and the breaking change number are read in
+    // the last round and the remaining registers in the first cycle after. With a cached
+    // link calibration they are also read in the first round, to compare the breaking change
+    // number, and the last round is the one that can check the cached loop time.
+    bool lastInitRound = !initComplete && (remoteTimeHandler.hasAllInitSamples() ||
+            (linkCalibrationCached && (initState == 0 ||
+            remoteTimeHandler.canCheckLoopCycleTime(cachedLinkCalibration.loopCycleTime))));
+
+    for (size_t i = 0; i < activeIntReads.size(); i++)
+    {
+        if (initComplete)
+        {
+            requestedIntReads[i] = activeIntReads[i] || isScheduledRead(intReadSchedules[i]);
+        }
+        else
+        {
+            requestedIntReads[i] = lastInitRound && (i == 3 || i == 10 || i == 11);
+        }
+    }
+    requestReads(requestedIntReads, true);
+
+    for (size_t i = 0; i < activeCharReads.size(); i++)
+    {
+        if (initComplete)
+        {
+            requestedCharReads[i] = activeCharReads[i] || isScheduledRead(charReadSchedules[i]);
+        }
+        else
+        {
+            requestedCharReads[i] = i == 11 || (lastInitRound && (i == 9 || i == 15));
+        }
+    }
+    requestReads(requestedCharReads, false);
+
+    if (initComplete)
+    {
+        ++readScheduleCycleNr;
+    }
+
+    loopNrReadActive = requestedCharReads[11];
+
+    referenceSent = false;
+    if (isInitComplete())
+    {
+        if (newPositionReference)
+        {
+            referenceSent = true;
+            unsigned char applyLoopNr = 0;
+            if (timedReferences && breakingChangeNr >= 4 &&
+                    remoteTimeHandler.getLoopNr(referenceApplyTime, applyLoopNr))
+            {
+                bus->write(13, static_cast<char>(applyLoopNr));
+                bus->write(0, static_cast<short int>(refPos));
+                bus->write(1, refVel);
+                bus->write(2, feedforwardU);
+            }
+            else if (breakingChangeNr < 3 ||
+                    !bus->writeBroadcastReference(static_cast<short int>(refPos), refVel, feedforwardU))
+            {
+                bus->write(0, static_cast<short int>(refPos));
+                bus->write(1, refVel);
+                bus->write(2, feedforwardU);
+            }
+
+            activeRefPos[4] = activeRefPos[3];
+            activeRefPos[3] = activeRefPos[2];
+            activeRefPos[2] = activeRefPos[1];
+            activeRefPos[1] = activeRefPos[0];
+            activeRefPos[0] = refPos;
+
+            newPositionReference = false;
+        }
+        else if (newOpenLoopControlSignal)
+        {
+            bus->write(2, feedforwardU);
+            bus->write(1, static_cast<char>(pwmOpenLoopMode));
+
+            newOpenLoopControlSignal = false;
+        }
+
+        activeFeedforwardU[4] = activeFeedforwardU[3];
+        activeFeedforwardU[3] = activeFeedforwardU[2];
+        activeFeedforwardU[2] = activeFeedforwardU[1];
+        activeFeedforwardU[1] = activeFeedforwardU[0];
+        activeFeedforwardU[0] = feedforwardU;
+    }
+    else if (initState == 0)
+    {
+        // The configuration is sent in one frame until the first response is received
+        bus->write(2, static_cast<char>(backlashControlDisabled));
+
+        bus->write(3, static_cast<char>(controlSpeed));
+        bus->write(4, static_cast<char>(std::round(velControlSpeed / 4.0)));
+        bus->write(5, static_cast<char>(std::round(filterSpeed / 32.0)));
+        bus->write(10, static_cast<char>(inertiaMarg));
+        bus->write(6, static_cast<char>(backlashCompensationSpeed));
+        bus->write(7, static_cast<char>(backlashCompensationSpeedVelDecrease));
+        bus->write(8, static_cast<char>(backlashSize));
+    }
+}
+
+void DCServoCommunicator::completeRun()
+{
+    using namespace std::chrono;
+    steady_clock::time_point startTime = steady_clock::now();
+
+    bus->setNodeNr(nodeNr);
+
+    // Requested reads stay active and the init sequence waits until a response is received
+    communicationIsOk = bus->getCommunicationStatus(nodeNr).lastTransactionOk;
+    if (!communicationIsOk)
+    {
+        return;
+    }
+
+    busTimeHistogram.record(bus->getLastTransactionTime(nodeNr));
+
+    for (size_t i = 0; i < activeIntReads.size(); i++)
+    {
+        if (requestedIntReads[i])
+        {
+            if (isInitComplete())
+            {
+                activeIntReads[i] = false;
+            }
+            intReadBuffer[i] = bus->getLastReadInt(i);
+        }
+    }
+
+    for (size_t i = 0; i < activeCharReads.size(); i++)
+    {
+        if (requestedCharReads[i])
+        {
+            if (isInitComplete())
+            {
+                activeCharReads[i] = false;
+            }
+            charReadBuffer[i] = bus->getLastReadChar(i);
+        }
+    }
+
+    if (isInitComplete())
+    {
+        intReadBufferIndex3Upscaling.update(intReadBuffer[3]);
+        intReadBufferIndex10Upscaling.update(intReadBuffer[10]);
+        intReadBufferIndex11Upscaling.update(intReadBuffer[11]);
+
+        if (loopNrReadActive)
+        {
+            remoteTimeHandler.update(charReadBuffer[11]);
+        }
+    }
+    else
+    {
+        long int upscaledPos = static_cast<unsigned short int>(intReadBuffer[3]);
+        upscaledPos += (static_cast<long int>(charReadBuffer[9]) << 16);
+        if (upscaledPos >= (1l << 23))
+        {
+            upscaledPos -= (1l << 24);
+        }
+
+        long int encPosWithBacklashComp = intReadBuffer[10] + static_cast<long int>(intReadBuffer[11]);
+
+        long int overflowedPart = ((upscaledPos - encPosWithBacklashComp) / (1l << 16)) << 16;
+
+        intReadBufferIndex3Upscaling.set(upscaledPos);
+        intReadBufferIndex10Upscaling.set(intReadBuffer[10]);
+        intReadBufferIndex11Upscaling.set(intReadBuffer[11] + overflowedPart);
+    }
+    
+    backlashEncoderPos = intReadBufferIndex3Upscaling.get() * (1.0 / positionUpscaling);
+    encoderPos = intReadBufferIndex10Upscaling.get() * (1.0 / positionUpscaling);
+    backlashCompensation = intReadBufferIndex11Upscaling.get() * (1.0 / positionUpscaling);
+
+    encoderVel = intReadBuffer[4] * (1.0 / velocityUpscaling);
+    controlSignal = intReadBuffer[5];
+    current = intReadBuffer[6];
+    pwmControlSignal = intReadBuffer[7];
+    cpuLoad = intReadBuffer[8];
+    loopTime = intReadBuffer[9];
+    opticalEncoderChannelData.a = intReadBuffer[12];
+    opticalEncoderChannelData.b = intReadBuffer[13];
+    opticalEncoderChannelData.minCostIndex = intReadBuffer[14];
+    opticalEncoderChannelData.minCost = intReadBuffer[15];
+
+    lowLevelControlError = static_cast<signed char>(charReadBuffer[12]) * 0.001f;
+
+    if (!isInitComplete())
+    {
+        ++initState;
+
+        if (static_cast<unsigned char>(charReadBuffer[15]) != cachedLinkCalibration.breakingChangeNr)
+        {
+            linkCalibrationCached = false;
+        }
+
+        remoteTimeHandler.initialize(charReadBuffer[11]);
+
+        // The cached loop time is used once it is confirmed by the loop numbers, otherwise
+        // the init sequence continues with the samples collected so far. The check is only
+        // done in the rounds that read the positions.
+        if (linkCalibrationCached && initState != 1 && requestedCharReads[15] &&
+                remoteTimeHandler.canCheckLoopCycleTime(cachedLinkCalibration.loopCycleTime))
+        {
+            linkCalibrationCached = remoteTimeHandler.matchesLoopCycleTime(cachedLinkCalibration.loopCycleTime);
+            if (linkCalibrationCached)
+            {
+                linkCalibrationValidated = true;
+                remoteTimeHandler.initialize(charReadBuffer[11], cachedLinkCalibration.loopCycleTime);
+            }
+        }
+
+        float pos;
+        if (!backlashControlDisabled)
+        {
+            pos = backlashEncoderPos;
+        }
+        else
+        {
+            pos = encoderPos;
+        }
+
+        activeRefPos[0] = pos * positionUpscaling;
+        activeRefPos[1] = activeRefPos[0];
+        activeRefPos[2] = activeRefPos[1];
+        activeRefPos[3] = activeRefPos[2];
+        activeRefPos[4] = activeRefPos[3];
+
+        if (isInitComplete())
+        {
+            updateOffset();
+
+            breakingChangeNr = static_cast<unsigned char>(charReadBuffer[15]);
+            if (breakingChangeNr >= 1)
+            {
+                velocityUpscaling = 8;
+            }
+
+            if (linkCalibrationCache && !linkCalibrationValidated &&
+                    remoteTimeHandler.getLoopCycleTime() != -1.0 && !bus->getName().empty())
+            {
+                linkCalibrationCache->set(bus->getName(), nodeNr,
+                        LinkCalibrationCache::Entry{breakingChangeNr, remoteTimeHandler.getLoopCycleTime()});
+            }
+        }
     }
+
+    decodeTimeHistogram.record(duration<double>(steady_clock::now() - startTime).count());
+}
+
+const LatencyHistogram& DCServoCommunicator::getBusTimeHistogram() const
+{
+    return busTimeHistogram;
+}
+
+const LatencyHistogram& DCServoCommunicator::getDecodeTimeHistogram() const
+{
+    return decodeTimeHistogram;
+}
+
+DCServoCommunicator::ControlLoopSyncedTimeHandler::ControlLoopSyncedTimeHandler(std::shared_ptr<Clock> clock) :
+    clock{clock}
+{
 }
 
-void DCServoCommunicator::setControlSpeed(unsigned char controlSpeed, double inertiaMarg)
+bool DCServoCommunicator::ControlLoopSyncedTimeHandler::isInitialized() const
 {
-    setControlSpeed(controlSpeed, controlSpeed * 4, controlSpeed * 32, inertiaMarg);
+    return loopCycleTime != 0.0;
 }
 
-void DCServoCommunicator::setControlSpeed(unsigned char controlSpeed,
-        unsigned short int velControlSpeed, unsigned short int filterSpeed,
-        double inertiaMarg)
+void DCServoCommunicator::ControlLoopSyncedTimeHandler::startSample()
 {
-    this->controlSpeed = controlSpeed;
-    this->velControlSpeed = velControlSpeed;
-    this->filterSpeed = filterSpeed;
-    inertiaMarg = std::min(std::max(inertiaMarg, 1.0), 1.0 + 255.0 / 128);
-    this->inertiaMarg = static_cast<unsigned char>(std::round((inertiaMarg - 1.0) * 128.0));
+    sampleRequestTimePoint = clock->now();
 }
 
-void DCServoCommunicator::setBacklashControlSpeed(unsigned char backlashCompensationSpeed,
-            double backlashCompensationCutOffSpeed,
-            double backlashSize)
+void DCServoCommunicator::ControlLoopSyncedTimeHandler::addInitSample(double localTime, unsigned char loopNr)
 {
-    this->backlashCompensationSpeed = backlashCompensationSpeed;
-    this->backlashCompensationSpeedVelDecrease = static_cast<unsigned char>(std::min(255.0,
-            255 * 10 / (backlashCompensationCutOffSpeed / std::abs(scale))));
-    this->backlashSize = static_cast<unsigned char>(backlashSize / std::abs(scale));
+    double requestLocalTime = std::chrono::duration<double>(sampleRequestTimePoint - initTimePoint).count();
+    initDataList.push_back(InitData{localTime, std::min(requestLocalTime, localTime), loopNr});
 }
 
-void DCServoCommunicator::setFrictionCompensation(double fricComp)
+void DCServoCommunicator::ControlLoopSyncedTimeHandler::initialize(unsigned char loopNr, double loopCycleTime)
 {
-    this->frictionCompensation = fricComp;
+    initDataList.clear();
+    addInitSample(getLocalTime(), loopNr);
+    this->loopCycleTime = loopCycleTime;
 }
 
+// The first sample is not used for the check, the first transactions after a start are often delayed
+bool DCServoCommunicator::ControlLoopSyncedTimeHandler::canCheckLoopCycleTime(double loopCycleTime) const
+{
+    return initDataList.size() >= 2 &&
+            getLocalTime() - initDataList[1].localTime >= minCheckedLoops * loopCycleTime;
+}
 
-void DCServoCommunicator::disableBacklashControl(bool b)
+bool DCServoCommunicator::ControlLoopSyncedTimeHandler::matchesLoopCycleTime(double loopCycleTime) const
 {
-    backlashControlDisabled = b;
+    if (initDataList.size() < 3)
+    {
+        return false;
+    }
+
+    // The loop of a sample started at most one loop before the loop number was requested and
+    // before the responses of the batch were received, which can be long after the node read
+    // its loop number if the other frames are large. With the right loop time the start of
+    // the first loop fits within the bounds of all samples.
+    double maxLowerBound = std::numeric_limits<double>::lowest();
+    double minUpperBound = std::numeric_limits<double>::max();
+    long int nrOfLoops = 0;
+    for (size_t i = 1; i != initDataList.size(); ++i)
+    {
+        if (i != 1)
+        {
+            nrOfLoops += static_cast<unsigned char>(initDataList[i].loopNr - initDataList[i - 1].loopNr);
+        }
+
+        maxLowerBound = std::max(maxLowerBound, initDataList[i].requestLocalTime - (nrOfLoops + 1) * loopCycleTime);
+        minUpperBound = std::min(minUpperBound, initDataList[i].localTime - nrOfLoops * loopCycleTime);
+    }
+
+    // Loop times are multiples of 200 us, so neighbouring rates differ by several percent
+    double span = initDataList.back().localTime - initDataList[1].localTime;
+    return maxLowerBound <= minUpperBound + 0.02 * span;
 }
 
-bool DCServoCommunicator::isInitComplete() const
+double DCServoCommunicator::ControlLoopSyncedTimeHandler::getLoopCycleTime() const
 {
-    return initState >= 10 and remoteTimeHandler.isInitialized();
+    return loopCycleTime;
 }
 
-bool DCServoCommunicator::isCommunicationOk() const
+bool DCServoCommunicator::ControlLoopSyncedTimeHandler::hasAllInitSamples() const
 {
-    return communicationIsOk;
+    return initDataList.size() >= nrOfInitSamples;
 }
 
-void DCServoCommunicator::setReference(const float& pos, const float& vel, const float& feedforwardU)
+bool DCServoCommunicator::ControlLoopSyncedTimeHandler::initialize(unsigned char loopNr)
 {
-    newPositionReference = true;
-    newOpenLoopControlSignal = false;
-    refPos = std::round((pos - offset) / scale * positionUpscaling);
-    refVel = std::round(vel / scale * velocityUpscaling);
+    if (isInitialized())
+    {
+        return true;
+    }
 
-    if (refVel > 4 * velocityUpscaling)
+    if (!hasAllInitSamples())
     {
-        frictionCompensation = std::abs(frictionCompensation);
+        // Samples within the same control loop, e.g. from a fast simulated bus, say nothing
+        // about the loop time. They are only used if the loop number does not change at all.
+        double localTime = getLocalTime();
+        if (initDataList.empty() || initDataList.back().loopNr != loopNr ||
+                localTime - initDataList.back().localTime > 0.02)
+        {
+            addInitSample(localTime, loopNr);
+        }
+        return false;
     }
-    else if (refVel < -4 * velocityUpscaling)
+
+    std::vector<double> listOfDt;
+    for (size_t i = 0; i != initDataList.size() - 1; ++i)
     {
-        frictionCompensation = -std::abs(frictionCompensation);
+        const auto& d0 = initDataList[i];
+        const auto& d1 = initDataList[i + 1];
+        double localTimeDiff = d1.localTime - d0.localTime;
+        char loopNrDiff = static_cast<char>(d1.loopNr - d0.loopNr);
+
+        if (loopNrDiff == 0)
+        {
+            continue;
+        }
+
+        listOfDt.push_back(localTimeDiff / loopNrDiff);
     }
-    this->feedforwardU = std::round(feedforwardU + frictionCompensation);
+
+    std::sort(listOfDt.begin(), listOfDt.end());
+
+    size_t cutI = listOfDt.size() / 4;
+    listOfDt = std::vector<double>{listOfDt.begin() + cutI, listOfDt.end() - cutI};
+
+    if (listOfDt.size() == 0)
+    {
+        loopCycleTime = -1.0;
+        return true;
+    }
+
+    loopCycleTime = 0.0;
+    for (auto dt : listOfDt)
+    {
+        loopCycleTime += dt;
+    }
+    loopCycleTime /= listOfDt.size();
+    loopCycleTime = std::round(loopCycleTime / us200) * us200;
+    return true;
 }
 
-void DCServoCommunicator::setOpenLoopControlSignal(const float& feedforwardU, bool pwmMode)
+void DCServoCommunicator::ControlLoopSyncedTimeHandler::update(unsigned char loopNr)
 {
-    newOpenLoopControlSignal = true;
-    newPositionReference = false;
-    pwmOpenLoopMode = pwmMode;
-    this->feedforwardU = feedforwardU;
+    double localTime = getLocalTime();
+
+    if (loopCycleTime == -1.0)
+    {
+        lastRemoteTime = localTime;
+        return;
+    }
+
+    // The wrapped loop numbers are unwrapped with the tracked loop time, so that drift
+    // does not build up between samples that are far apart
+    double expectedNrOfLoops = filterInitialized ?
+            (localTime - loopLocalTime) / localLoopCycleTime :
+            (localTime - initDataList.back().localTime) / loopCycleTime;
+
+    long int nrOfLoops = static_cast<unsigned char>(loopNr - initDataList.back().loopNr);
+    nrOfLoops += std::round((expectedNrOfLoops - nrOfLoops) / 256) * 256;
+
+    // A loop number older than the last one is from a stale response
+    if (nrOfLoops < 0)
+    {
+        return;
+    }
+
+    lastRemoteTime += nrOfLoops * loopCycleTime;
+
+    updateFilter(nrOfLoops, localTime);
+
+    initDataList.back().localTime = localTime;
+    initDataList.back().loopNr = loopNr;
 }
 
-float DCServoCommunicator::getPosition(bool withBacklash) const
+void DCServoCommunicator::ControlLoopSyncedTimeHandler::updateFilter(long int nrOfLoops, double localTime)
 {
-    float pos;
-    if (withBacklash && !backlashControlDisabled)
+    // The loop time is modeled as a random walk of 1e-9 relative per loop
+    const double loopTimeNoise = loopCycleTime * 1e-9;
+    const double minMeasurementVariance = 1e-12;
+
+    if (!filterInitialized || rejectedSamples > 10)
     {
-        activeIntReads[3] = true;
-        pos = backlashEncoderPos;
+        filterInitialized = true;
+        loopLocalTime = localTime;
+        localLoopCycleTime = loopCycleTime;
+        measurementVariance = 1e-6;
+        covariance00 = measurementVariance;
+        covariance01 = 0.0;
+        covariance11 = (loopCycleTime * 1e-3) * (loopCycleTime * 1e-3);
+        rejectedSamples = 0;
+        return;
     }
-    else
+
+    double n = nrOfLoops;
+    loopLocalTime += n * localLoopCycleTime;
+    covariance00 += 2.0 * n * covariance01 + n * n * covariance11;
+    covariance01 += n * covariance11;
+    covariance11 += n * loopTimeNoise * loopTimeNoise;
+
+    double innovation = localTime - loopLocalTime;
+    double predictedVariance = covariance00;
+    double innovationVariance = predictedVariance + measurementVariance;
+    if (innovation * innovation > 25.0 * innovationVariance)
     {
-        activeIntReads[10] = true;
-        pos = encoderPos;
+        ++rejectedSamples;
+        return;
     }
+    rejectedSamples = 0;
 
-    return scale * pos + offset;
+    double gain0 = covariance00 / innovationVariance;
+    double gain1 = covariance01 / innovationVariance;
+    loopLocalTime += gain0 * innovation;
+    localLoopCycleTime += gain1 * innovation;
+    covariance11 -= gain1 * covariance01;
+    covariance01 -= gain0 * covariance01;
+    covariance00 -= gain0 * covariance00;
+
+    measurementVariance = std::max(0.95 * measurementVariance +
+            0.05 * (innovation * innovation - predictedVariance), minMeasurementVariance);
 }
 
-float DCServoCommunicator::getVelocity() const
+double DCServoCommunicator::ControlLoopSyncedTimeHandler::get() const
 {
-    activeIntReads[4] = true;
-    return scale * encoderVel;
+  return lastRemoteTime;
 }
 
-float DCServoCommunicator::getControlSignal() const
+double DCServoCommunicator::ControlLoopSyncedTimeHandler::toLocalTime(double remoteTime) const
 {
-    activeIntReads[5] = true;
-    return controlSignal;
+    double localTime = remoteTime;
+    if (loopCycleTime != -1.0 && filterInitialized)
+    {
+        localTime = loopLocalTime + (remoteTime - lastRemoteTime) / loopCycleTime * localLoopCycleTime;
+    }
+    return localTime + std::chrono::duration<double>(initTimePoint.time_since_epoch()).count();
 }
 
-float DCServoCommunicator::getFeedforwardU() const
+double DCServoCommunicator::ControlLoopSyncedTimeHandler::toRemoteTime(double localTime) const
 {
-    return activeFeedforwardU[2];
+    localTime -= std::chrono::duration<double>(initTimePoint.time_since_epoch()).count();
+    if (loopCycleTime == -1.0 || !filterInitialized)
+    {
+        return localTime;
+    }
+    return lastRemoteTime + (localTime - loopLocalTime) / localLoopCycleTime * loopCycleTime;
 }
 
-float DCServoCommunicator::getControlError(bool withBacklash) const
+double DCServoCommunicator::ControlLoopSyncedTimeHandler::getDrift() const
 {
-    float pos;
-    if (!backlashControlDisabled)
+    if (loopCycleTime == -1.0 || !filterInitialized)
     {
-        if (withBacklash)
-        {
-            activeIntReads[3] = true;
-            pos = backlashEncoderPos;
-        }
-        else
-        {
-            activeIntReads[10] = true;
-            activeIntReads[11] = true;
-            pos = encoderPos + backlashCompensation;
-        }
+        return 0.0;
     }
-    else
+    return localLoopCycleTime / loopCycleTime - 1.0;
+}
+
+double DCServoCommunicator::ControlLoopSyncedTimeHandler::getSyncError() const
+{
+    if (loopCycleTime == -1.0 || !filterInitialized || rejectedSamples > 10)
     {
-        activeIntReads[10] = true;
-        pos = encoderPos;
+        return std::numeric_limits<double>::infinity();
     }
-
-    return scale * (activeRefPos[2] * (1.0 / positionUpscaling) - pos);
+    return std::sqrt(covariance00);
 }
 
-float DCServoCommunicator::getCurrent() const
+bool DCServoCommunicator::ControlLoopSyncedTimeHandler::getLoopNr(double localTime, unsigned char& loopNr) const
 {
-    activeIntReads[6] = true;
-    return current;
+    if (loopCycleTime == -1.0 || !isInitialized() || initDataList.empty())
+    {
+        return false;
+    }
+
+    // A time that has already passed, e.g. in a late cycle, is aimed at the running loop,
+    // which the firmware applies directly. The firmware treats loop numbers more than 127
+    // loops ahead as already passed, so later times are limited to 100 loops ahead.
+    double nowTime = std::chrono::duration<double>(clock->now().time_since_epoch()).count();
+    bool late = localTime < nowTime;
+    localTime = std::min(std::max(localTime, nowTime), nowTime + 100.0 * loopCycleTime);
+
+    // Until the filter is (re)started the loops are counted from the last sample
+    double loopsSinceLastSample = filterInitialized ?
+            (toRemoteTime(localTime) - lastRemoteTime) / loopCycleTime :
+            (localTime - std::chrono::duration<double>(initTimePoint.time_since_epoch()).count() -
+            initDataList.back().localTime) / loopCycleTime;
+    loopsSinceLastSample = late ? std::floor(loopsSinceLastSample) : std::round(loopsSinceLastSample);
+    loopNr = static_cast<unsigned char>(initDataList.back().loopNr + static_cast<long int>(loopsSinceLastSample));
+    return true;
 }
 
-short int DCServoCommunicator::getPwmControlSignal() const
+double DCServoCommunicator::ControlLoopSyncedTimeHandler::getLocalTime() const
 {
-    activeIntReads[7] = true;
-    return pwmControlSignal;
+    using namespace std::chrono;
+
+    if (initDataList.size() == 0)
+    {
+        initTimePoint = clock->now();
+        return 0.0;
+    }
+
+    double localTime = std::chrono::duration<double>(clock->now() - initTimePoint).count();
+    return localTime;
 }
 
-short int DCServoCommunicator::getCpuLoad() const
+ServoManager::ServoManager(double cycleTime,
+        std::function<std::vector<std::unique_ptr<DCServoCommunicator> >() > initFunction,
+        bool startManager) :
+    servos{initFunction()},
+    cycleTime{cycleTime},
+    clock{servos.empty() ? SteadyClock::getInstance() : servos.front()->getBus()->getClock()}
 {
-    activeIntReads[8] = true;
-    return cpuLoad;
+    for (auto& s : servos)
+    {
+        if (s->getBus()->getClock() != clock)
+        {
+            throw std::runtime_error("All buses of a servo manager must use the same clock");
+        }
+    }
+
+    for (auto& s : servos)
+    {
+        auto it = std::find_if(busThreads.begin(), busThreads.end(),
+                [&s](const BusThread& b){ return b.bus == s->getBus(); });
+        if (it == busThreads.end())
+        {
+            busThreads.emplace_back();
+            busThreads.back().bus = s->getBus();
+            it = busThreads.end() - 1;
+        }
+        it->servos.push_back(s.get());
+    }
+
+    initServos();
+
+    for (auto& s : servos)
+    {
+        // The position is always needed for the servo state snapshots
+        if (s->getPollingDivisor(DCServoCommunicator::ReadValue::position) == 0)
+        {
+            s->setPollingDivisor(DCServoCommunicator::ReadValue::position, 1);
+        }
+    }
+
+    for (size_t i = 0; i != servos.size(); ++i)
+    {
+        referenceQueues.push_back(std::make_unique<ReferenceQueue>());
+    }
+
+    currentServoStates.servos.resize(servos.size());
+    updateServoStates();
+    servoStateBuffer.initialize(currentServoStates);
+
+    if (startManager)
+    {
+        start();
+    }
 }
 
-short int DCServoCommunicator::getLoopTime() const
+ServoManager::~ServoManager()
 {
-    activeIntReads[9] = true;
-    return loopTime;
+    shutdown();
+
+    delete handlerFunctions.load();
 }
 
-double DCServoCommunicator::getTime() const
+void ServoManager::run()
 {
-    activeCharReads[11] = true;
-    return remoteTimeHandler.get();
-}
+    managerThreadId = std::this_thread::get_id();
+
+    while (waitForThreadInit && !shuttingDown)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    using namespace std::chrono;
+    steady_clock::time_point sleepUntilTimePoint = clock->now();
+    steady_clock::duration clockDurationCycleTime(
+            duration_cast<steady_clock::duration>(duration<double>(cycleTime)));
+
+    while (!shuttingDown)
+    {
+        try
+        {
+            cycleSleepTime = duration<double>(sleepUntilTimePoint - clock->now()).count();
+            sleepUntil(sleepUntilTimePoint);
+            steady_clock::time_point cycleStartTime = steady_clock::now();
+            wakeupJitter = duration<double>(clock->now() - sleepUntilTimePoint).count();
+            maxWakeupJitter = std::max(maxWakeupJitter.load(), wakeupJitter.load());
+            wakeupLatenessHistogram.record(wakeupJitter);
+            sleepUntilTimePoint += clockDurationCycleTime;
+            transactionDeadline = sleepUntilTimePoint;
+            time = currentServoStates.cycleNr * cycleTime;
+
+            double referenceApplyTime = duration<double>(sleepUntilTimePoint.time_since_epoch()).count();
+            for (auto& s : servos)
+            {
+                s->setReferenceApplyTime(referenceApplyTime);
+            }
+
+            applyQueuedReferences();
+
+            const HandlerFunctions* handlers = acquireHandlerFunctions();
+
+            steady_clock::time_point sendHandlerStartTime = steady_clock::now();
+            if (handlers != nullptr && handlers->sendCommandHandlerFunction)
+            {
+                handlers->sendCommandHandlerFunction(cycleTime, *this);
+            }
+            steady_clock::time_point sendHandlerEndTime = steady_clock::now();
+            sendHandlerTimeHistogram.record(duration<double>(sendHandlerEndTime - sendHandlerStartTime).count());
+
+            runServos();
+
+            updateServoStates();
+            ++currentServoStates.cycleNr;
+            if (telemetryRecorder)
+            {
+                telemetryRecorder->record(currentServoStates, time);
+            }
+            servoStateBuffer.write([this](ServoStateSnapshot& states){ states = currentServoStates; });
+
+            steady_clock::time_point readHandlerStartTime = steady_clock::now();
+            if (handlers != nullptr && handlers->readResultHandlerFunction)
+            {
+                handlers->readResultHandlerFunction(cycleTime, *this);
+            }
+            steady_clock::time_point readHandlerEndTime = steady_clock::now();
+
+            releaseHandlerFunctions();
+
+            readHandlerTimeHistogram.record(duration<double>(readHandlerEndTime - readHandlerStartTime).count());
+            cycleTimeHistogram.record(duration<double>(readHandlerEndTime - cycleStartTime).count());
+        }
+        catch (...)
+        {
+            auto e = std::current_exception();
 
-float DCServoCommunicator::getBacklashCompensation() const
-{
-    activeIntReads[11] = true;
-    return scale * backlashCompensation;
-}
+            const HandlerFunctions* handlers = acquireHandlerFunctions();
 
-DCServoCommunicator::OpticalEncoderChannelData DCServoCommunicator::getOpticalEncoderChannelData() const
-{
-    activeIntReads[12] = true;
-    activeIntReads[13] = true;
-    activeIntReads[14] = true;
-    activeIntReads[15] = true;
-    return opticalEncoderChannelData;
+            if (handlers != nullptr && handlers->errorHandlerFunction)
+            {
+                shutdown();
+                handlers->errorHandlerFunction(e);
+                releaseHandlerFunctions();
+            }
+            else if (delayedExceptionsEnabled)
+            {
+                releaseHandlerFunctions();
+                registerUnhandledException(e);
+                shutdown();
+            }
+            else
+            {
+                releaseHandlerFunctions();
+                std::rethrow_exception(e);
+            }
+        }
+    }
 }
 
-float DCServoCommunicator::getLowLevelControlError() const
+void ServoManager::sleepUntil(std::chrono::steady_clock::time_point deadline)
 {
-    activeCharReads[12] = true;
-    return scale * lowLevelControlError;
-}
+    using namespace std::chrono;
 
-double DCServoCommunicator::getScaling() const
-{
-    return scale;
-}
+    if (!realTimeModeEnabled || clock->isVirtual())
+    {
+        clock->sleepUntil(deadline);
+        return;
+    }
 
-double DCServoCommunicator::getOffset() const
-{
-    return offset;
+    // steady_clock is CLOCK_MONOTONIC on Linux
+    auto sleepEnd = deadline - duration_cast<steady_clock::duration>(
+            duration<double>(realTimeConfig.busySpinTime));
+    auto ns = duration_cast<nanoseconds>(sleepEnd.time_since_epoch()).count();
+    timespec ts;
+    ts.tv_sec = ns / 1000000000;
+    ts.tv_nsec = ns % 1000000000;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR)
+    {
+    }
+
+    while (steady_clock::now() < deadline)
+    {
+    }
 }
 
-void DCServoCommunicator::run()
+static void setRealTimeScheduling(std::thread& t, int priority, int cpu)
 {
-    bus->setNodeNr(nodeNr);
-
-    for (size_t i = 0; i < activeIntReads.size(); i++)
+    sched_param param{};
+    param.sched_priority = priority;
+    int error = pthread_setschedparam(t.native_handle(), SCHED_FIFO, &param);
+    if (error != 0)
     {
-        if (activeIntReads[i])
-        {
-            bus->requestReadInt(i);
-        }
+        throw std::runtime_error(std::string("Could not set SCHED_FIFO priority: ") + std::strerror(error));
     }
 
-    for (size_t i = 0; i < activeCharReads.size(); i++)
+    if (cpu >= 0)
     {
-        if (activeCharReads[i])
+        cpu_set_t cpuSet;
+        CPU_ZERO(&cpuSet);
+        CPU_SET(cpu, &cpuSet);
+        error = pthread_setaffinity_np(t.native_handle(), sizeof(cpuSet), &cpuSet);
+        if (error != 0)
         {
-            bus->requestReadChar(i);
+            throw std::runtime_error(std::string("Could not set CPU affinity: ") + std::strerror(error));
         }
     }
+}
 
-    bool loopNrReadActive = activeCharReads[11];
-
-    if (isInitComplete())
+void ServoManager::runServos()
+{
+    if (busThreads.empty())
     {
-        if (newPositionReference)
-        {
-            bus->write(0, static_cast<short int>(refPos));
-            bus->write(1, refVel);
-            bus->write(2, feedforwardU);
-
-            activeRefPos[4] = activeRefPos[3];
-            activeRefPos[3] = activeRefPos[2];
-            activeRefPos[2] = activeRefPos[1];
-            activeRefPos[1] = activeRefPos[0];
-            activeRefPos[0] = refPos;
+        return;
+    }
 
-            newPositionReference = false;
-        }
-        else if (newOpenLoopControlSignal)
+    // Without started bus threads, e.g. when run() is called directly, all buses are run here
+    bool parallel = busThreads.back().t.joinable();
+    if (parallel)
+    {
         {
-            bus->write(2, feedforwardU);
-            bus->write(1, static_cast<char>(pwmOpenLoopMode));
-
-            newOpenLoopControlSignal = false;
+            const std::lock_guard<std::mutex> lock(busCycleMutex);
+            ++busCycleNr;
+            busThreadsRunning = busThreads.size() - 1;
         }
+        busCycleStart.notify_all();
 
-        activeFeedforwardU[4] = activeFeedforwardU[3];
-        activeFeedforwardU[3] = activeFeedforwardU[2];
-        activeFeedforwardU[2] = activeFeedforwardU[1];
-        activeFeedforwardU[1] = activeFeedforwardU[0];
-        activeFeedforwardU[0] = feedforwardU;
+        runBus(busThreads[0]);
     }
     else
     {
-        bus->write(2, static_cast<char>(backlashControlDisabled));
-
-        bus->write(3, static_cast<char>(controlSpeed));
-        bus->write(4, static_cast<char>(std::round(velControlSpeed / 4.0)));
-        bus->write(5, static_cast<char>(std::round(filterSpeed / 32.0)));
-        bus->write(10, static_cast<char>(inertiaMarg));
-        bus->write(6, static_cast<char>(backlashCompensationSpeed));
-        bus->write(7, static_cast<char>(backlashCompensationSpeedVelDecrease));
-        bus->write(8, static_cast<char>(backlashSize));
+        for (auto& b : busThreads)
+        {
+            runBus(b);
+        }
     }
 
-    bus->execute();
+    if (parallel)
+    {
+        std::unique_lock<std::mutex> lock(busCycleMutex);
+        busCycleDone.wait(lock, [this](){ return busThreadsRunning == 0; });
+    }
 
-    for (size_t i = 0; i < activeIntReads.size(); i++)
+    for (auto& b : busThreads)
     {
-        if (activeIntReads[i])
+        if (b.exception)
         {
-
-            if (isInitComplete())
-            {
-                activeIntReads[i] = false;
-            }
-            intReadBuffer[i] = bus->getLastReadInt(i);
+            auto e = b.exception;
+            b.exception = std::exception_ptr();
+            std::rethrow_exception(e);
         }
     }
+}
 
-    for (size_t i = 0; i < activeCharReads.size(); i++)
+void ServoManager::initServos()
+{
+    // The simulated servos share the virtual clock, their buses are initialized one at a time
+    if (clock->isVirtual())
     {
-        if (activeCharReads[i])
+        for (auto& b : busThreads)
         {
-            if (isInitComplete())
-            {
-                activeCharReads[i] = false;
-            }
-            charReadBuffer[i] = bus->getLastReadChar(i);
+            initBus(b);
         }
     }
-
-    if (isInitComplete())
+    else
     {
-        intReadBufferIndex3Upscaling.update(intReadBuffer[3]);
-        intReadBufferIndex10Upscaling.update(intReadBuffer[10]);
-        intReadBufferIndex11Upscaling.update(intReadBuffer[11]);
+        for (size_t i = 1; i < busThreads.size(); ++i)
+        {
+            busThreads[i].t = std::thread{&ServoManager::initBus, this, std::ref(busThreads[i])};
+        }
 
-        if (loopNrReadActive)
+        if (!busThreads.empty())
         {
-            remoteTimeHandler.update(charReadBuffer[11]);
+            initBus(busThreads[0]);
+        }
+
+        for (size_t i = 1; i < busThreads.size(); ++i)
+        {
+            busThreads[i].t.join();
         }
     }
-    else
+
+    for (auto& b : busThreads)
     {
-        long int upscaledPos = static_cast<unsigned short int>(intReadBuffer[3]);
-        upscaledPos += (static_cast<long int>(charReadBuffer[9]) << 16);
-        if (upscaledPos >= (1l << 23))
+        if (b.exception)
         {
-            upscaledPos -= (1l << 24);
+            auto e = b.exception;
+            b.exception = std::exception_ptr();
+            std::rethrow_exception(e);
         }
+    }
+}
 
-        long int encPosWithBacklashComp = intReadBuffer[10] + static_cast<long int>(intReadBuffer[11]);
+void ServoManager::initBus(BusThread& busThread)
+{
+    using namespace std::chrono;
+    steady_clock::duration clockDurationCycleTime(
+            duration_cast<steady_clock::duration>(duration<double>(cycleTime)));
 
-        long int overflowedPart = ((upscaledPos - encPosWithBacklashComp) / (1l << 16)) << 16;
+    // All nodes of the bus are initialized together, one batched transaction per round
+    while (!busThread.exception && !std::all_of(busThread.servos.begin(), busThread.servos.end(),
+            [](const DCServoCommunicator* s){ return s->isInitComplete(); }))
+    {
+        runBus(busThread);
 
-        intReadBufferIndex3Upscaling.set(upscaledPos);
-        intReadBufferIndex10Upscaling.set(intReadBuffer[10]);
-        intReadBufferIndex11Upscaling.set(intReadBuffer[11] + overflowedPart);
+        // Lets the simulated servos run between the time synchronization samples
+        if (clock->isVirtual())
+        {
+            clock->sleepUntil(clock->now() + clockDurationCycleTime);
+        }
     }
-    
-    backlashEncoderPos = intReadBufferIndex3Upscaling.get() * (1.0 / positionUpscaling);
-    encoderPos = intReadBufferIndex10Upscaling.get() * (1.0 / positionUpscaling);
-    backlashCompensation = intReadBufferIndex11Upscaling.get() * (1.0 / positionUpscaling);
-
-    encoderVel = intReadBuffer[4] * (1.0 / velocityUpscaling);
-    controlSignal = intReadBuffer[5];
-    current = intReadBuffer[6];
-    pwmControlSignal = intReadBuffer[7];
-    cpuLoad = intReadBuffer[8];
-    loopTime = intReadBuffer[9];
-    opticalEncoderChannelData.a = intReadBuffer[12];
-    opticalEncoderChannelData.b = intReadBuffer[13];
-    opticalEncoderChannelData.minCostIndex = intReadBuffer[14];
-    opticalEncoderChannelData.minCost = intReadBuffer[15];
+}
 
-    lowLevelControlError = static_cast<signed char>(charReadBuffer[12]) * 0.001f;
+void ServoManager::runBus(BusThread& busThread)
+{
+    using namespace std::chrono;
+    high_resolution_clock::time_point startTime = high_resolution_clock::now();
 
-    if (!isInitComplete())
+    try
     {
-        ++initState;
-
-        remoteTimeHandler.initialize(charReadBuffer[11]);
+        busThread.bus->setTransactionDeadline(transactionDeadline);
 
-        float pos;
-        if (!backlashControlDisabled)
+        for (auto s : busThread.servos)
         {
-            pos = backlashEncoderPos;
+            s->queueRun();
         }
-        else
+
+        busThread.bus->executeQueue();
+
+        for (auto s : busThread.servos)
         {
-            pos = encoderPos;
+            s->completeRun();
         }
+    }
+    catch (...)
+    {
+        busThread.exception = std::current_exception();
+    }
 
-        activeRefPos[0] = pos * positionUpscaling;
-        activeRefPos[1] = activeRefPos[0];
-        activeRefPos[2] = activeRefPos[1];
-        activeRefPos[3] = activeRefPos[2];
-        activeRefPos[4] = activeRefPos[3];
+    busThread.cycleTime = duration<double>(high_resolution_clock::now() - startTime).count();
+}
 
-        if (isInitComplete())
+void ServoManager::busThreadLoop(BusThread& busThread, size_t lastCycleNr)
+{
+    while (true)
+    {
         {
-            updateOffset();
+            std::unique_lock<std::mutex> lock(busCycleMutex);
+            busCycleStart.wait(lock, [this, lastCycleNr](){
+                    return busThreadsShuttingDown || busCycleNr != lastCycleNr; });
 
-            breakingChangeNr = static_cast<unsigned char>(charReadBuffer[15]);
-            if (breakingChangeNr >= 1)
+            if (busThreadsShuttingDown)
             {
-                velocityUpscaling = 8;
+                return;
             }
+            lastCycleNr = busCycleNr;
+        }
+
+        runBus(busThread);
+
+        {
+            const std::lock_guard<std::mutex> lock(busCycleMutex);
+            --busThreadsRunning;
         }
+        busCycleDone.notify_one();
     }
 }
 
-DCServoCommunicator::ControlLoopSyncedTimeHandler::ControlLoopSyncedTimeHandler()
+void ServoManager::startBusThreads(std::function<void(std::thread&)> threadInitFunction)
 {
+    busThreadsShuttingDown = false;
+
+    // The first bus is run by the manager thread itself
+    for (size_t i = 1; i < busThreads.size(); ++i)
+    {
+        busThreads[i].t = std::thread{&ServoManager::busThreadLoop, this, std::ref(busThreads[i]), busCycleNr};
+        threadInitFunction(busThreads[i].t);
+    }
 }
 
-bool DCServoCommunicator::ControlLoopSyncedTimeHandler::isInitialized() const
+void ServoManager::stopBusThreads()
 {
-    return loopCycleTime != 0.0;
+    {
+        const std::lock_guard<std::mutex> lock(busCycleMutex);
+        busThreadsShuttingDown = true;
+    }
+    busCycleStart.notify_all();
+
+    for (auto& b : busThreads)
+    {
+        if (b.t.joinable())
+        {
+            b.t.join();
+        }
+    }
 }
 
-bool DCServoCommunicator::ControlLoopSyncedTimeHandler::initialize(unsigned char loopNr)
+void ServoManager::updateServoStates()
 {
-    if (isInitialized())
+    for (size_t i = 0; i != servos.size(); ++i)
     {
-        return true;
+        servos[i]->getState(currentServoStates.servos[i]);
     }
+}
 
-    if (initDataList.size() < 20)
+template <typename Function>
+void ServoManager::readServoStates(Function readFunction) const
+{
+    if (std::this_thread::get_id() == managerThreadId.load())
     {
-        initDataList.push_back(InitData{getLocalTime(), loopNr});
-        return false;
+        readFunction(currentServoStates);
+        return;
     }
+    servoStateBuffer.read(readFunction);
+}
 
-    std::vector<double> listOfDt;
-    for (size_t i = 0; i != initDataList.size() - 1; ++i)
-    {
-        const auto& d0 = initDataList[i];
-        const auto& d1 = initDataList[i + 1];
-        double localTimeDiff = d1.localTime - d0.localTime;
-        char loopNrDiff = static_cast<char>(d1.loopNr - d0.loopNr);
+ReferenceQueue::ReferenceQueue(size_t capacity) :
+    queue(capacity)
+{
+}
 
-        if (loopNrDiff == 0)
-        {
-            continue;
-        }
+size_t ReferenceQueue::push(Span<const TimedReference> references)
+{
+    return queue.push(references);
+}
 
-        listOfDt.push_back(localTimeDiff / loopNrDiff);
-    }
+bool ReferenceQueue::push(const TimedReference& reference)
+{
+    return queue.push(reference);
+}
 
-    std::sort(listOfDt.begin(), listOfDt.end());
+size_t ReferenceQueue::size() const
+{
+    return queue.size();
+}
 
-    size_t cutI = listOfDt.size() / 4;
-    listOfDt = std::vector<double>{listOfDt.begin() + cutI, listOfDt.end() - cutI};
+size_t ReferenceQueue::capacity() const
+{
+    return queue.capacity();
+}
 
-    if (listOfDt.size() == 0)
+size_t ReferenceQueue::getUnderrunCount() const
+{
+    return underrunCount;
+}
+
+size_t ReferenceQueue::getLateReferenceCount() const
+{
+    return lateReferenceCount;
+}
+
+bool ReferenceQueue::getReference(double time, TimedReference& reference)
+{
+    // A reference that would have been used by the previous call was not queued then
+    double previousTime = lastTime;
+    lastTime = time;
+
+    while (!queue.empty() && queue.front().time <= time)
     {
-        loopCycleTime = -1.0;
-        return true;
+        if (queue.front().time <= previousTime)
+        {
+            ++lateReferenceCount;
+        }
+        previous = queue.front();
+        hasPrevious = true;
+        queue.pop();
     }
 
-    loopCycleTime = 0.0;
-    for (auto dt : listOfDt)
+    if (!hasPrevious)
     {
-        loopCycleTime += dt;
+        return false;
+    }
+
+    if (queue.empty())
+    {
+        reference = previous;
+        if (previous.time < time)
+        {
+            reference.velocity = 0.0;
+            reference.feedForward = 0.0;
+            hasPrevious = false;
+            ++underrunCount;
+        }
+        return true;
     }
-    loopCycleTime /= listOfDt.size();
-    loopCycleTime = std::round(loopCycleTime / us200) * us200;
+
+    const TimedReference& next = queue.front();
+    double t = (time - previous.time) / (next.time - previous.time);
+    reference.time = time;
+    reference.position = previous.position + t * (next.position - previous.position);
+    reference.velocity = previous.velocity + t * (next.velocity - previous.velocity);
+    reference.feedForward = previous.feedForward + t * (next.feedForward - previous.feedForward);
     return true;
 }
 
-void DCServoCommunicator::ControlLoopSyncedTimeHandler::update(unsigned char loopNr)
+constexpr char TelemetryFileHeader::magicValue[8];
+
+TelemetryRecorder::TelemetryRecorder(const std::string& fileName, size_t capacity, size_t queueCapacity) :
+    queue(queueCapacity)
 {
-    double localTime = getLocalTime();
+    if (capacity == 0)
+    {
+        throw std::invalid_argument("Telemetry file capacity must not be zero");
+    }
 
-    if (loopCycleTime == -1.0)
+    fd = ::open(fileName.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
     {
-        lastRemoteTime = localTime;
-        return;
+        throw std::runtime_error("Could not open telemetry file " + fileName + ": " + std::strerror(errno));
     }
 
-    double localTimeDiff = localTime - initDataList.back().localTime;
+    mappedSize = sizeof(TelemetryFileHeader) + capacity * sizeof(TelemetryRecord);
+    int error = ::posix_fallocate(fd, 0, mappedSize);
+    void* mapped = error == 0 ? ::mmap(nullptr, mappedSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+    if (mapped == MAP_FAILED)
+    {
+        error = error != 0 ? error : errno;
+        ::close(fd);
+        throw std::runtime_error("Could not allocate telemetry file " + fileName + ": " + std::strerror(error));
+    }
 
-    unsigned long nrOfLoops = static_cast<unsigned char>(loopNr - initDataList.back().loopNr);
-    nrOfLoops += std::round((localTimeDiff / loopCycleTime - nrOfLoops) / 256) * 256;
+    header = static_cast<TelemetryFileHeader*>(mapped);
+    records = reinterpret_cast<TelemetryRecord*>(header + 1);
 
-    lastRemoteTime += nrOfLoops * loopCycleTime;
+    std::copy(std::begin(TelemetryFileHeader::magicValue), std::end(TelemetryFileHeader::magicValue), header->magic);
+    header->version = TelemetryFileHeader::currentVersion;
+    header->recordSize = sizeof(TelemetryRecord);
+    header->capacity = capacity;
+    header->writeCount = 0;
+    header->cycleTime = 0.0;
 
-    initDataList.back().localTime = localTime;
-    initDataList.back().loopNr = loopNr;
+    t = std::thread{&TelemetryRecorder::writerLoop, this};
 }
 
-double DCServoCommunicator::ControlLoopSyncedTimeHandler::get() const
+TelemetryRecorder::~TelemetryRecorder()
 {
-  return lastRemoteTime;
+    shuttingDown = true;
+    if (t.joinable())
+    {
+        t.join();
+    }
+
+    ::msync(header, mappedSize, MS_SYNC);
+    ::munmap(header, mappedSize);
+    ::close(fd);
 }
 
-double DCServoCommunicator::ControlLoopSyncedTimeHandler::getLocalTime() const
+void TelemetryRecorder::record(const ServoStateSnapshot& snapshot, double time)
 {
-    using namespace std::chrono;
-
-    if (initDataList.size() == 0)
+    for (size_t i = 0; i != snapshot.servos.size(); ++i)
     {
-        initTimePoint = high_resolution_clock::now();
-        return 0.0;
+        const ServoState& state = snapshot.servos[i];
+
+        TelemetryRecord record;
+        record.cycleNr = snapshot.cycleNr;
+        record.time = time;
+        record.position = state.position;
+        record.velocity = state.velocity;
+        record.current = state.current;
+        record.controlError = state.controlError;
+        record.remoteTime = state.remoteTime;
+        record.referencePosition = state.referencePosition;
+        record.referenceVelocity = state.referenceVelocity;
+        record.referenceFeedForward = state.referenceFeedForward;
+        record.loopTime = state.loopTime;
+        record.servoIndex = static_cast<uint16_t>(i);
+        record.communicationOk = state.communicationOk;
+        record.referenceSent = state.referenceSent;
+
+        if (!queue.push(record))
+        {
+            ++droppedCount;
+        }
     }
+}
 
-    double localTime = std::chrono::duration<double>(high_resolution_clock::now()
-            - initTimePoint).count();
-    return localTime;
+void TelemetryRecorder::setCycleTime(double cycleTime)
+{
+    header->cycleTime = cycleTime;
 }
 
-ServoManager::ServoManager(double cycleTime,
-        std::function<std::vector<std::unique_ptr<DCServoCommunicator> >() > initFunction,
-        bool startManager) :
-    servos{initFunction()},
-    cycleTime{cycleTime}
+size_t TelemetryRecorder::getDroppedCount() const
+{
+    return droppedCount;
+}
+
+void TelemetryRecorder::writerLoop()
 {
+    uint64_t writeCount = 0;
+    const uint64_t capacity = header->capacity;
+
     while (true)
     {
-        bool allDone = true;
-        for (auto& s : servos)
+        bool lastRound = shuttingDown;
+
+        uint64_t oldWriteCount = writeCount;
+        while (!queue.empty())
         {
-            allDone &= s->isInitComplete();
-            s->run();
+            records[writeCount % capacity] = queue.front();
+            queue.pop();
+            ++writeCount;
         }
 
-        if (allDone)
+        if (writeCount != oldWriteCount)
         {
-            break;
+            header->writeCount.store(writeCount, std::memory_order_release);
         }
-    }
 
-    for (auto& s : servos)
-    {
-        currentPosition.push_back(s->getPosition());
-    }
+        if (lastRound)
+        {
+            break;
+        }
 
-    if (startManager)
-    {
-        start();
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
     }
 }
 
-ServoManager::~ServoManager()
+TelemetryReader::TelemetryReader(const std::string& fileName)
 {
-    shutdown();
-}
+    fd = ::open(fileName.c_str(), O_RDONLY);
+    struct stat fileStat;
+    if (fd < 0 || ::fstat(fd, &fileStat) != 0)
+    {
+        int error = errno;
+        if (fd >= 0)
+        {
+            ::close(fd);
+        }
+        throw std::runtime_error("Could not open telemetry file " + fileName + ": " + std::strerror(error));
+    }
 
-void ServoManager::run()
-{
-    while (waitForThreadInit && !shuttingDown)
+    mappedSize = fileStat.st_size;
+    void* mapped = mappedSize >= sizeof(TelemetryFileHeader) ?
+            ::mmap(nullptr, mappedSize, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    if (mapped == MAP_FAILED)
     {
-        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        ::close(fd);
+        throw std::runtime_error("Could not map telemetry file " + fileName);
     }
 
-    using namespace std::chrono;
-    high_resolution_clock::time_point sleepUntilTimePoint = high_resolution_clock::now();
-    high_resolution_clock::duration clockDurationCycleTime(
-            duration_cast<high_resolution_clock::duration>(duration<double>(cycleTime)));
+    header = static_cast<const TelemetryFileHeader*>(mapped);
+    records = reinterpret_cast<const TelemetryRecord*>(header + 1);
 
-    while (!shuttingDown)
+    if (!std::equal(std::begin(TelemetryFileHeader::magicValue), std::end(TelemetryFileHeader::magicValue), header->magic) ||
+            header->version != TelemetryFileHeader::currentVersion ||
+            header->recordSize != sizeof(TelemetryRecord) ||
+            header->capacity == 0 ||
+            mappedSize < sizeof(TelemetryFileHeader) + header->capacity * sizeof(TelemetryRecord))
     {
-        try
-        {
-            cycleSleepTime = std::chrono::duration<double>(sleepUntilTimePoint - high_resolution_clock::now()).count();
-            std::this_thread::sleep_until(sleepUntilTimePoint);
-            sleepUntilTimePoint += clockDurationCycleTime;
+        ::munmap(const_cast<TelemetryFileHeader*>(header), mappedSize);
+        ::close(fd);
+        throw std::runtime_error("Not a telemetry file of version " +
+                std::to_string(TelemetryFileHeader::currentVersion) + ": " + fileName);
+    }
 
-            std::function<void(double, ServoManager&)> tempSendHandlerFunction;
-            std::function<void(double, ServoManager&)> tempReadHandlerFunction;
+    writeCount = header->writeCount.load(std::memory_order_acquire);
+}
 
-            {
-                const std::lock_guard<std::mutex> lock(handlerFunctionMutex);
-                tempSendHandlerFunction = sendCommandHandlerFunction;
-                tempReadHandlerFunction = readResultHandlerFunction;
-            }
+TelemetryReader::~TelemetryReader()
+{
+    ::munmap(const_cast<TelemetryFileHeader*>(header), mappedSize);
+    ::close(fd);
+}
 
-            if (tempSendHandlerFunction)
-            {
-                tempSendHandlerFunction(cycleTime, *this);
-            }
+size_t TelemetryReader::size() const
+{
+    return std::min(writeCount, header->capacity);
+}
 
-            for (auto& s : servos)
-            {
-                s->run();
-            }
+const TelemetryRecord& TelemetryReader::operator[](size_t i) const
+{
+    uint64_t first = writeCount - size();
+    return records[(first + i) % header->capacity];
+}
 
-            for (size_t i = 0; i != servos.size(); ++i)
-            {
-                currentPosition[i] = servos[i]->getPosition();
-            }
+double TelemetryReader::getCycleTime() const
+{
+    return header->cycleTime;
+}
 
-            if (tempReadHandlerFunction)
-            {
-                tempReadHandlerFunction(cycleTime, *this);
-            }
-        }
-        catch (...)
-        {
-            auto e = std::current_exception();
+void TelemetryReader::writeCsv(std::ostream& out) const
+{
+    out << "cycleNr,time,servoIndex,position,velocity,current,controlError,loopTime,remoteTime,communicationOk,"
+            "referencePosition,referenceVelocity,referenceFeedForward,referenceSent\n";
+    out << std::setprecision(10);
+    for (size_t i = 0; i != size(); ++i)
+    {
+        const TelemetryRecord& r = (*this)[i];
+        out << r.cycleNr << ',' << r.time << ',' << r.servoIndex << ',' << r.position << ','
+                << r.velocity << ',' << r.current << ',' << r.controlError << ',' << r.loopTime << ','
+                << r.remoteTime << ',' << static_cast<int>(r.communicationOk) << ',' << r.referencePosition << ','
+                << r.referenceVelocity << ',' << r.referenceFeedForward << ',' << static_cast<int>(r.referenceSent) << '\n';
+    }
+}
 
-            std::function<void(std::exception_ptr e)> tempErrorHandlerFunction;
+void TelemetryReader::writeNumpy(std::ostream& out) const
+{
+    // Version 1.0 of the .npy format, the header is padded to make the data 64 byte aligned
+    std::string dictionary = "{'descr': [('cycleNr', '<u8'), ('time', '<f8'), ('position', '<f8'), "
+            "('velocity', '<f8'), ('current', '<f8'), ('controlError', '<f8'), ('remoteTime', '<f8'), "
+            "('referencePosition', '<f8'), ('referenceVelocity', '<f8'), ('referenceFeedForward', '<f8'), "
+            "('loopTime', '<i2'), ('servoIndex', '<u2'), ('communicationOk', '|u1'), ('referenceSent', '|u1'), "
+            "('', '|V10')], "
+            "'fortran_order': False, 'shape': (" + std::to_string(size()) + ",), }";
+    const size_t preambleSize = 10;
+    dictionary.append(63 - (preambleSize + dictionary.size()) % 64, ' ');
+    dictionary.push_back('\n');
+
+    out.write("\x93NUMPY\x01\x00", 8);
+    out.put(static_cast<char>(dictionary.size() & 0xff));
+    out.put(static_cast<char>(dictionary.size() >> 8));
+    out << dictionary;
+
+    for (size_t i = 0; i != size(); ++i)
+    {
+        out.write(reinterpret_cast<const char*>(&(*this)[i]), sizeof(TelemetryRecord));
+    }
+}
 
-            {
-                const std::lock_guard<std::mutex> lock(handlerFunctionMutex);
-                tempErrorHandlerFunction = errorHandlerFunction;
-            }
+std::vector<double> ServoManager::getPosition() const
+{
+    std::vector<double> position(servos.size());
+    getPosition(position);
+    return position;
+}
 
-            if (tempErrorHandlerFunction)
-            {
-                shutdown();
-                tempErrorHandlerFunction(e);
-            }
-            else if (delayedExceptionsEnabled)
-            {
-                registerUnhandledException(e);
-                shutdown();
-            }
-            else
+void ServoManager::getPosition(Span<double> position) const
+{
+    readServoStates([&position](const ServoStateSnapshot& states)
+        {
+            size_t size = std::min(position.size(), states.servos.size());
+            for (size_t i = 0; i != size; ++i)
             {
-                std::rethrow_exception(e);
+                position[i] = states.servos[i].position;
             }
-        }
-    }
+        });
 }
 
-std::vector<double> ServoManager::getPosition() const
+void ServoManager::getServoStates(ServoStateSnapshot& snapshot) const
 {
-    return currentPosition;
+    snapshot.servos.resize(servos.size());
+    readServoStates([&snapshot](const ServoStateSnapshot& states){ snapshot = states; });
 }
 
 void ServoManager::setHandlerFunctions(std::function<void(double, ServoManager&)> newSendCommandHandlerFunction, 
         std::function<void(double, ServoManager&)> newReadResultHandlerFunction,
         std::function<void(std::exception_ptr e)> newErrorHandlerFunction)
 {
+    auto newHandlers = std::make_unique<HandlerFunctions>();
+    newHandlers->sendCommandHandlerFunction = newSendCommandHandlerFunction;
+    newHandlers->readResultHandlerFunction = newReadResultHandlerFunction;
+    newHandlers->errorHandlerFunction = newErrorHandlerFunction;
+
     const std::lock_guard<std::mutex> lock(handlerFunctionMutex);
 
-    sendCommandHandlerFunction = newSendCommandHandlerFunction;
-    readResultHandlerFunction = newReadResultHandlerFunction;
-    errorHandlerFunction = newErrorHandlerFunction;
+    HandlerFunctions* oldHandlers = handlerFunctions.exchange(newHandlers.release());
+    if (oldHandlers != nullptr)
+    {
+        retiredHandlerFunctions.emplace_back(oldHandlers);
+    }
+
+    // Retired handlers can only be deleted when the manager thread is not using them
+    const HandlerFunctions* handlersInUse = handlerFunctionsInUse.load();
+    retiredHandlerFunctions.erase(std::remove_if(retiredHandlerFunctions.begin(), retiredHandlerFunctions.end(),
+            [handlersInUse](const std::unique_ptr<HandlerFunctions>& h){ return h.get() != handlersInUse; }),
+            retiredHandlerFunctions.end());
+}
+
+const ServoManager::HandlerFunctions* ServoManager::acquireHandlerFunctions()
+{
+    // Publish the pointer before using it and check that it was not
+    // replaced in between, see setHandlerFunctions()
+    HandlerFunctions* handlers = handlerFunctions.load();
+    while (true)
+    {
+        handlerFunctionsInUse.store(handlers);
+        HandlerFunctions* currentHandlers = handlerFunctions.load();
+        if (currentHandlers == handlers)
+        {
+            return handlers;
+        }
+        handlers = currentHandlers;
+    }
+}
+
+void ServoManager::releaseHandlerFunctions()
+{
+    handlerFunctionsInUse.store(nullptr, std::memory_order_release);
 }
 
 void ServoManager::removeHandlerFunctions()
@@ -994,16 +3493,45 @@ void ServoManager::removeHandlerFunctions()
 void ServoManager::start(std::function<void(std::thread&)> threadInitFunction)
 {
     shuttingDown = false;
-    if (t.get_id() == std::this_thread::get_id())
+    if (managerThreadId.load() == std::this_thread::get_id())
     {
         return;
     }
 
     if (!t.joinable())
     {
+        if (realTimeModeEnabled && realTimeConfig.lockMemory &&
+                mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+        {
+            shuttingDown = true;
+            throw std::runtime_error(std::string("Could not lock memory: ") + std::strerror(errno));
+        }
+
+        startBusThreads(threadInitFunction);
+
         waitForThreadInit = true;
         t = std::thread{&ServoManager::run, this};
         threadInitFunction(t);
+
+        if (realTimeModeEnabled)
+        {
+            try
+            {
+                setRealTimeScheduling(t, realTimeConfig.priority, realTimeConfig.managerCpu);
+                for (size_t i = 1; i < busThreads.size(); ++i)
+                {
+                    int cpu = i - 1 < realTimeConfig.busThreadCpus.size() ?
+                            realTimeConfig.busThreadCpus[i - 1] : -1;
+                    setRealTimeScheduling(busThreads[i].t, realTimeConfig.priority, cpu);
+                }
+            }
+            catch (...)
+            {
+                shutdown();
+                throw;
+            }
+        }
+
         waitForThreadInit = false;
     }
 }
@@ -1011,7 +3539,7 @@ void ServoManager::start(std::function<void(std::thread&)> threadInitFunction)
 void ServoManager::shutdown()
 {
     shuttingDown = true;
-    if (t.get_id() == std::this_thread::get_id())
+    if (managerThreadId.load() == std::this_thread::get_id())
     {
         return;
     }
@@ -1020,6 +3548,9 @@ void ServoManager::shutdown()
     {
         t.join();
     }
+    managerThreadId = std::thread::id();
+
+    stopBusThreads();
 }
 
 void ServoManager::registerUnhandledException(std::exception_ptr e)
@@ -1034,6 +3565,20 @@ void ServoManager::enableDelayedExceptions(bool enable)
     delayedExceptionsEnabled = enable;
 }
 
+void ServoManager::enableRealTimeMode(bool enable, const RealTimeConfig& config)
+{
+    bool restart = !shuttingDown;
+    shutdown();
+
+    realTimeModeEnabled = enable;
+    realTimeConfig = config;
+
+    if (restart)
+    {
+        start();
+    }
+}
+
 std::exception_ptr ServoManager::getUnhandledException()
 {
     const std::lock_guard<std::mutex> lock(handlerFunctionMutex);
@@ -1064,3 +3609,199 @@ double ServoManager::getCycleSleepTime() const
 {
     return cycleSleepTime;
 }
+
+size_t ServoManager::getNumberOfBuses() const
+{
+    return busThreads.size();
+}
+
+double ServoManager::getBusCycleTime(size_t busIndex) const
+{
+    return busThreads.at(busIndex).cycleTime;
+}
+
+double ServoManager::getTime() const
+{
+    return time;
+}
+
+ReferenceQueue& ServoManager::getReferenceQueue(size_t servoIndex)
+{
+    return *referenceQueues.at(servoIndex);
+}
+
+void ServoManager::applyQueuedReferences()
+{
+    TimedReference reference;
+    for (size_t i = 0; i != servos.size(); ++i)
+    {
+        if (referenceQueues[i]->getReference(time, reference))
+        {
+            servos[i]->setReference(reference.position, reference.velocity, reference.feedForward);
+        }
+    }
+}
+
+void ServoManager::setTelemetryRecorder(std::shared_ptr<TelemetryRecorder> recorder)
+{
+    if (!shuttingDown)
+    {
+        throw std::runtime_error("The telemetry recorder can not be set while the manager is running");
+    }
+    telemetryRecorder = recorder;
+    if (telemetryRecorder)
+    {
+        telemetryRecorder->setCycleTime(cycleTime);
+    }
+}
+
+std::shared_ptr<Clock> ServoManager::getClock() const
+{
+    return clock;
+}
+
+CycleTimingSnapshot ServoManager::getTimingSnapshot() const
+{
+    CycleTimingSnapshot snapshot;
+    snapshot.wakeupLateness = wakeupLatenessHistogram.getStatistics();
+    snapshot.sendHandlerTime = sendHandlerTimeHistogram.getStatistics();
+    snapshot.readHandlerTime = readHandlerTimeHistogram.getStatistics();
+    snapshot.cycleTime = cycleTimeHistogram.getStatistics();
+
+    for (const auto& s : servos)
+    {
+        snapshot.nodeBusTime.push_back(s->getBusTimeHistogram().getStatistics());
+        snapshot.nodeDecodeTime.push_back(s->getDecodeTimeHistogram().getStatistics());
+    }
+
+    return snapshot;
+}
+
+double ServoManager::getWakeupJitter() const
+{
+    return wakeupJitter;
+}
+
+double ServoManager::getMaxWakeupJitter() const
+{
+    return maxWakeupJitter;
+}
+
+TelemetryReplay::TelemetryReplay(const TelemetryReader& recording,
+        std::function<std::vector<std::unique_ptr<DCServoCommunicator> >(Communication*)> servoFactory) :
+    recording(recording),
+    servoFactory(servoFactory)
+{
+}
+
+void TelemetryReplay::setTelemetryRecorder(std::shared_ptr<TelemetryRecorder> recorder)
+{
+    telemetryRecorder = recorder;
+}
+
+TelemetryReplayReport TelemetryReplay::run()
+{
+    if (recording.getCycleTime() <= 0.0)
+    {
+        throw std::runtime_error("The recording has no cycle time");
+    }
+
+    // The oldest cycle of a ring file can be partly overwritten
+    size_t begin = 0;
+    while (begin != recording.size() && recording[begin].servoIndex != 0)
+    {
+        ++begin;
+    }
+
+    TelemetryReplayReport report;
+    if (begin == recording.size())
+    {
+        return report;
+    }
+
+    auto clock = std::make_shared<VirtualClock>();
+    SimulateCommunication bus(clock);
+    ServoManager manager(recording.getCycleTime(), [this, &bus](){ return servoFactory(&bus); }, false);
+    manager.setTelemetryRecorder(telemetryRecorder);
+
+    report.servos.resize(manager.servos.size());
+    std::vector<double> sumOfSquares(manager.servos.size(), 0.0);
+    ServoStateSnapshot snapshot;
+    snapshot.servos.resize(manager.servos.size());
+
+    uint64_t cycleNr = recording[begin].cycleNr;
+    size_t sendIndex = begin;
+    size_t compareIndex = begin;
+    std::promise<void> done;
+
+    auto sendCommandHandlerFunction = [&](double, ServoManager& manager)
+        {
+            for (; sendIndex != recording.size() && recording[sendIndex].cycleNr <= cycleNr; ++sendIndex)
+            {
+                const TelemetryRecord& r = recording[sendIndex];
+                if (r.cycleNr == cycleNr && r.referenceSent && r.servoIndex < manager.servos.size())
+                {
+                    manager.servos[r.servoIndex]->setReference(r.referencePosition, r.referenceVelocity,
+                            r.referenceFeedForward);
+                }
+            }
+        };
+
+    auto readResultHandlerFunction = [&](double, ServoManager& manager)
+        {
+            manager.getServoStates(snapshot);
+
+            for (; compareIndex != recording.size() && recording[compareIndex].cycleNr <= cycleNr; ++compareIndex)
+            {
+                const TelemetryRecord& r = recording[compareIndex];
+                if (r.cycleNr != cycleNr || r.servoIndex >= snapshot.servos.size())
+                {
+                    continue;
+                }
+
+                const ServoState& state = snapshot.servos[r.servoIndex];
+                TelemetryReplayReport::ServoDiff& diff = report.servos[r.servoIndex];
+                double positionDiff = std::abs(state.position - r.position);
+                diff.maxPositionDiff = std::max(diff.maxPositionDiff, positionDiff);
+                diff.maxVelocityDiff = std::max(diff.maxVelocityDiff, std::abs(state.velocity - r.velocity));
+                diff.maxControlErrorDiff = std::max(diff.maxControlErrorDiff,
+                        std::abs(state.controlError - r.controlError));
+                sumOfSquares[r.servoIndex] += positionDiff * positionDiff;
+                ++diff.comparedCycles;
+            }
+
+            ++report.replayedCycles;
+            ++cycleNr;
+
+            if (compareIndex == recording.size())
+            {
+                manager.shutdown();
+                done.set_value();
+            }
+        };
+
+    auto errorHandlerFunction = [&done](std::exception_ptr e)
+        {
+            done.set_exception(e);
+        };
+
+    manager.setHandlerFunctions(sendCommandHandlerFunction, readResultHandlerFunction, errorHandlerFunction);
+
+    auto startTime = std::chrono::steady_clock::now();
+    manager.start();
+    auto doneFuture = done.get_future();
+    doneFuture.wait();
+    report.replayTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    manager.shutdown();
+    doneFuture.get();
+
+    for (size_t i = 0; i != report.servos.size(); ++i)
+    {
+        if (report.servos[i].comparedCycles != 0)
+        {
+            report.servos[i].rmsPositionDiff = std::sqrt(sumOfSquares[i] / report.servos[i].comparedCycles);
+        }
+    }
+
+    return report;
+}
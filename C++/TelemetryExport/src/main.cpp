@@ -0,0 +1,45 @@
+#include "ServoProject.h"
+#include <iostream>
+#include <fstream>
+
+int main(int argc, char* argv[])
+{
+    if (argc != 3)
+    {
+        std::cout << "Usage: " << argv[0] << " <telemetry file> <output.csv | output.npy>\n";
+        return 1;
+    }
+
+    std::string outFileName = argv[2];
+    bool numpy = outFileName.size() >= 4 && outFileName.compare(outFileName.size() - 4, 4, ".npy") == 0;
+
+    try
+    {
+        TelemetryReader reader(argv[1]);
+
+        std::ofstream out(outFileName, numpy ? std::ios::binary : std::ios::out);
+        if (!out)
+        {
+            std::cout << "Could not open " << outFileName << "\n";
+            return 1;
+        }
+
+        if (numpy)
+        {
+            reader.writeNumpy(out);
+        }
+        else
+        {
+            reader.writeCsv(out);
+        }
+
+        std::cout << "Exported " << reader.size() << " records to " << outFileName << "\n";
+    }
+    catch (std::exception& e)
+    {
+        std::cout << e.what() << "\n";
+        return 1;
+    }
+
+    return 0;
+}
@@ -684,6 +684,10 @@ class DCServoCommunicator:
         # ----------------------------------------
         # 0 : version <= 4.0
         # 1 : version >= 4.1 : breaking change is velocityUpscaling = 8 > 1
+        # 2 : version >= 4.2 : block read commands for consecutive registers
+        # 3 : version >= 4.2 : broadcast reference frames to node number 0
+        # 4 : version >= 4.2 : char register 13 sets the loop number where int 0 to 2 take effect
+        # 5 : version >= 4.2 : frames to node number 128 + n repeat a frame to node n without applying it
         self.breakingChangeNr = None
 
     def setOffsetAndScaling(self, scale, offset, startPosition = 0):